@@ -0,0 +1,286 @@
+/************************************************************************/
+/* Benchmark:
+	times every stage of ImageMatchMerge on its own and end to end over
+	synthetic captures, and writes the results as JSON.
+	Halide_benchmark [--sizes 720p,1080p,1440p,4k,4k-tall] [--frames N]
+		[--reps N] [--out bench.json] [--dir bench_frames]
+	a size ending in -fuzzy redraws a few boxes of every frame, so no
+	overlap is exact and the scan (and the pyramid) do the matching
+*/
+/************************************************************************/
+
+#include "stdafx.h"
+#include "ImageMatchMerge.h"
+#include "RowPrefixSum.h"
+#include "Compositor.h"
+#include "PngRowSink.h"
+#include "SyntheticCapture.h"
+#include <direct.h>
+#include <chrono>
+#include <sstream>
+#include <algorithm>
+#include <functional>
+
+using namespace std;
+using namespace Halide;
+using namespace Halide::Tools;
+
+class StageBenchmark
+{
+public:
+	struct Result
+	{
+		string set, stage;
+		int reps;
+		double min_ms, median_ms, mean_ms;
+	};
+
+	StageBenchmark(int reps, const string& dir) : m_reps(reps), m_dir(dir) {}
+
+	// time each stage over one frame set, false if the result is wrong
+	bool runSet(const string& name, const SyntheticCapture& capture);
+
+	bool writeReport(const string& filename) const;
+
+private:
+	void measure(const string& stage, const function<void()>& fn);
+
+	int m_reps;
+	string m_dir, m_set;
+	vector<Result> m_results;
+	ostringstream m_checks;
+};
+
+void StageBenchmark::measure(const string& stage, const function<void()>& fn)
+{
+	vector<double> ms;
+	for (int i = 0; i < m_reps; ++i)
+	{
+		auto begin = chrono::steady_clock::now();
+		fn();
+		ms.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count());
+	}
+	sort(ms.begin(), ms.end());
+
+	Result r;
+	r.set = m_set;
+	r.stage = stage;
+	r.reps = m_reps;
+	r.min_ms = ms.front();
+	r.median_ms = ms[ms.size() / 2];
+	r.mean_ms = 0;
+	for (size_t i = 0; i < ms.size(); ++i)
+	{
+		r.mean_ms += ms[i] / ms.size();
+	}
+	m_results.push_back(r);
+
+	printf("%-14s %-22s %10.3f ms\n", r.set.c_str(), r.stage.c_str(), r.median_ms);
+}
+
+bool StageBenchmark::runSet(const string& name, const SyntheticCapture& capture)
+{
+	m_set = name;
+	const int num = capture.frames();
+
+	vector<Image<uint8_t> > frames(num);
+	vector<string> files(num);
+	for (int i = 0; i < num; ++i)
+	{
+		frames[i] = capture.frame(i);
+		files[i] = m_dir + "/" + name + "_" + to_string(i) + ".png";
+		save_image(frames[i], files[i]);
+	}
+
+	ImageMatchMerge merger;
+	ThreadPool pool;
+
+	vector<RowFingerprint> sums(num), sums20(num);
+	measure("rowPrefixSum", [&] {
+		for (int i = 0; i < num; ++i)
+		{
+			RowPrefixSum prefix(frames[i]);
+			sums[i].build(prefix.blockSums(10));
+			sums20[i].build(prefix.blockSums(20));
+		}
+	});
+
+	int head = 0, tail = 0;
+	measure("findHeadAndTail2", [&] {
+		auto ht = findHeadAndTail2(sums[0], sums[1]);
+		head = max(0, get<0>(ht));
+		tail = max(0, get<1>(ht));
+	});
+
+	vector<ImageView<uint8_t> > cuts(num);
+	vector<RowFingerprint> cut_sums(num);
+	measure("cut", [&] {
+		for (int i = 0; i < num; ++i)
+		{
+			cuts[i] = merger.cutHeadAndTail<uint8_t>(frames[i], head, tail);
+			cut_sums[i] = sums20[i].crop(head, tail);
+		}
+	});
+
+	vector<int> match(num, 0);
+	measure("avgMatchImages", [&] {
+		for (int i = 0; i < num - 1; ++i)
+		{
+			match[i] = merger.avgMatchImages(cut_sums[i], cut_sums[i + 1]);
+		}
+	});
+
+	// approximate, its offsets are reported but do not fail the set
+	vector<int> pyramid_match(num, 0);
+	merger.m_pyramid_levels = 4;
+	measure("avgMatchImagesPyramid", [&] {
+		for (int i = 0; i < num - 1; ++i)
+		{
+			pyramid_match[i] = merger.avgMatchImages(cut_sums[i], cut_sums[i + 1]);
+		}
+	});
+	merger.m_pyramid_levels = 0;
+
+	Image<uint8_t> result;
+	measure("joint", [&] {
+		Compositor joint;
+		joint.add(ImageView<uint8_t>(frames[0]).crop(0, head), 0);
+		int curh = head;
+		for (int i = 0; i < num; ++i)
+		{
+			int imgh = cuts[i].height() - match[i];
+			joint.add(cuts[i].crop(0, imgh), curh);
+			curh += imgh;
+		}
+		joint.add(ImageView<uint8_t>(frames[0]).crop(capture.m_height - tail, tail), curh);
+
+		result = Image<uint8_t>(capture.m_width, curh + tail, 3);
+		joint.blit(result, pool);
+	});
+
+	measure("encode", [&] {
+		PngRowSink sink(m_dir + "/" + name + "_result.png");
+		sink.writeRows(result);
+		sink.finish();
+	});
+
+	ImageMatchMerge e2e(files);
+	e2e.m_pool = &pool;
+	measure("run", [&] { e2e.run(); });
+	const int run_height = e2e.m_result.height();
+	measure("runPipelined", [&] { e2e.runPipelined(); });
+	const int pipelined_height = e2e.m_result.height();
+	measure("runStreaming", [&] { e2e.runStreaming(); });
+	const int streaming_height = e2e.m_result.height();
+
+	// ground truth
+	int match_errors = 0, pyramid_errors = 0;
+	for (int i = 0; i < num - 1; ++i)
+	{
+		// rows of header and footer left in the cuts are matched as well
+		const int expected = capture.overlap(i) + capture.m_header - head + capture.m_footer - tail;
+		if (match[i] != expected)
+			++match_errors;
+		if (pyramid_match[i] != expected)
+			++pyramid_errors;
+	}
+	const bool ok = match_errors == 0 && result.height() == capture.resultHeight() && 
+		run_height == capture.resultHeight() && pipelined_height == run_height && streaming_height == run_height;
+
+	if (m_checks.tellp() > 0)
+		m_checks << ",\n";
+	m_checks << "    {\"set\": \"" << name << "\", \"width\": " << capture.m_width 
+		<< ", \"height\": " << capture.m_height << ", \"frames\": " << num
+		<< ", \"header\": " << capture.m_header << ", \"footer\": " << capture.m_footer
+		<< ", \"detected_head\": " << head << ", \"detected_tail\": " << tail
+		<< ", \"patches\": " << capture.m_patches
+		<< ", \"match_errors\": " << match_errors << ", \"pyramid_match_errors\": " << pyramid_errors
+		<< ", \"expected_height\": " << capture.resultHeight() << ", \"result_height\": " << run_height
+		<< ", \"correct\": " << (ok ? "true" : "false") << "}";
+
+	return ok;
+}
+
+bool StageBenchmark::writeReport(const string& filename) const
+{
+	FILE* file = fopen(filename.c_str(), "w");
+	if (!file)
+		return false;
+
+	fprintf(file, "{\n  \"results\": [\n");
+	for (size_t i = 0; i < m_results.size(); ++i)
+	{
+		const Result& r = m_results[i];
+		fprintf(file, "    {\"set\": \"%s\", \"stage\": \"%s\", \"reps\": %d, "
+			"\"min_ms\": %.4f, \"median_ms\": %.4f, \"mean_ms\": %.4f}%s\n",
+			r.set.c_str(), r.stage.c_str(), r.reps, r.min_ms, r.median_ms, r.mean_ms,
+			i + 1 < m_results.size() ? "," : "");
+	}
+	fprintf(file, "  ],\n  \"checks\": [\n%s\n  ]\n}\n", m_checks.str().c_str());
+	fclose(file);
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	string sizes = "720p,1080p,1440p,4k,4k-tall,1080p-fuzzy,4k-tall-fuzzy", out = "bench.json", dir = "bench_frames";
+	int frames = 6, reps = 5;
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		string arg = argv[i];
+		if (arg == "--sizes")
+			sizes = argv[i + 1];
+		else if (arg == "--frames")
+			frames = max(2, atoi(argv[i + 1]));
+		else if (arg == "--reps")
+			reps = max(1, atoi(argv[i + 1]));
+		else if (arg == "--out")
+			out = argv[i + 1];
+		else if (arg == "--dir")
+			dir = argv[i + 1];
+		else
+		{
+			printf("unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	_mkdir(dir.c_str());
+	StageBenchmark bench(reps, dir);
+
+	bool ok = true;
+	stringstream list(sizes);
+	string size;
+	while (getline(list, size, ','))
+	{
+		const string suffix = "-fuzzy";
+		const bool fuzzy = size.size() > suffix.size() && 
+			size.compare(size.size() - suffix.size(), suffix.size(), suffix) == 0;
+		const string base = fuzzy ? size.substr(0, size.size() - suffix.size()) : size;
+
+		int width = 0, height = 0;
+		if (base == "720p") { width = 1280; height = 720; }
+		else if (base == "1080p") { width = 1920; height = 1080; }
+		else if (base == "1440p") { width = 2560; height = 1440; }
+		else if (base == "4k") { width = 3840; height = 2160; }
+		else if (base == "4k-tall") { width = 2160; height = 3840; }
+		else
+		{
+			printf("unknown size %s\n", size.c_str());
+			return 1;
+		}
+
+		if (!bench.runSet(size, SyntheticCapture(width, height, frames, 1, fuzzy ? 12 : 0)))
+		{
+			printf("%s: result does not match the ground truth\n", size.c_str());
+			ok = false;
+		}
+	}
+
+	if (!bench.writeReport(out))
+	{
+		printf("cannot write %s\n", out.c_str());
+		return 1;
+	}
+	return ok ? 0 : 2;
+}
@@ -0,0 +1,126 @@
+/************************************************************************/
+/* SyntheticCapture:
+	scrolling screenshot frame set with known ground truth: a text-like
+	page scrolled under a sticky header and footer by random steps.
+	every page row carries a unique gutter color, so the overlap between
+	frames is exact unless patches are asked for
+*/
+/************************************************************************/
+
+#include "stdafx.h"
+#include "SyntheticCapture.h"
+#include <random>
+
+using namespace std;
+
+SyntheticCapture::SyntheticCapture(int width, int height, int frames, unsigned seed, int patches)
+	: m_width(width), m_height(height), m_header(height / 12), m_footer(height / 20), m_patches(patches),
+	m_seed(seed)
+{
+	mt19937 rng(seed);
+
+	// scroll by a quarter to three quarters of the content each time
+	int page_height = content();
+	for (int i = 0; i + 1 < frames; ++i)
+	{
+		int step = content() / 4 + rng() % (content() / 2);
+		m_scroll.push_back(step);
+		page_height += step;
+	}
+
+	m_page = Halide::Image<uint8_t>(width, page_height, 3);
+
+	// background, then a gutter of row unique colors
+	const int gutter = 8, margin = 24;
+	for (int y = 0; y < page_height; ++y)
+	{
+		for (int x = 0; x < width; ++x)
+		{
+			for (int c = 0; c < 3; ++c)
+			{
+				m_page(x, y, c) = 250;
+			}
+		}
+		for (int x = 0; x < gutter; ++x)
+		{
+			m_page(x, y, 0) = y & 255;
+			m_page(x, y, 1) = (y >> 8) & 255;
+			m_page(x, y, 2) = 128;
+		}
+	}
+
+	// text lines of dark words with glyph-like holes
+	const int line_height = max(12, height / 45);
+	for (int top = 0; top + line_height <= page_height; top += line_height)
+	{
+		if (rng() % 8 == 0)
+			continue;
+
+		const uint8_t ink = rng() % 4 == 0 ? 40 + rng() % 80 : 20;
+		const int line_end = margin + rng() % max(1, width - 2 * margin);
+		for (int x = margin; x < line_end; )
+		{
+			const int word = 5 + rng() % 60;
+			for (int y = top + line_height / 5; y < top + line_height * 4 / 5; ++y)
+			{
+				for (int wx = x; wx < min(x + word, line_end); ++wx)
+				{
+					if ((wx * 7 + y * 3) % 5 < 3)
+					{
+						m_page(wx, y, 0) = ink;
+						m_page(wx, y, 1) = ink;
+						m_page(wx, y, 2) = ink + 20;
+					}
+				}
+			}
+			x += word + 6;
+		}
+	}
+}
+
+Halide::Image<uint8_t> SyntheticCapture::frame(int i) const
+{
+	int top = 0;
+	for (int k = 0; k < i; ++k)
+	{
+		top += m_scroll[k];
+	}
+
+	Halide::Image<uint8_t> output(m_width, m_height, 3);
+	for (int y = 0; y < m_height; ++y)
+	{
+		const bool header = y < m_header, footer = y >= m_height - m_footer;
+		for (int x = 0; x < m_width; ++x)
+		{
+			for (int c = 0; c < 3; ++c)
+			{
+				if (header)
+					output(x, y, c) = (x / 40 + y / 10) % 7 == 0 ? 200 : 40 + 25 * c;
+				else if (footer)
+					output(x, y, c) = (x / 60) % 5 == 0 ? 160 : 30;
+				else
+					output(x, y, c) = m_page(x, top + y - m_header, c);
+			}
+		}
+	}
+
+	// small boxes of the content, differently colored in every frame
+	mt19937 rng(m_seed * 7919 + i);
+	for (int p = 0; p < m_patches; ++p)
+	{
+		const int w = min(m_width, 16 + int(rng() % 48)), h = min(content(), 8 + int(rng() % 16));
+		const int x0 = rng() % (m_width - w + 1), y0 = m_header + rng() % (content() - h + 1);
+		const uint8_t color[3] = { uint8_t(rng()), uint8_t(rng()), uint8_t(rng()) };
+		for (int y = y0; y < y0 + h; ++y)
+		{
+			for (int x = x0; x < x0 + w; ++x)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					output(x, y, c) = color[c];
+				}
+			}
+		}
+	}
+	return output;
+}
@@ -0,0 +1,42 @@
+/************************************************************************/
+/* SyntheticCapture:
+	scrolling screenshot frame set with known ground truth: a text-like
+	page scrolled under a sticky header and footer by random steps.
+	every page row carries a unique gutter color, so the overlap between
+	frames is exact unless patches are asked for
+*/
+/************************************************************************/
+
+#pragma once
+#include <vector>
+#include "Halide.h"
+
+class SyntheticCapture
+{
+public:
+	// patches: boxes of the content redrawn in every frame (a blinking caret,
+	// a ticking clock), overlaps are then fuzzy
+	SyntheticCapture(int width, int height, int frames, unsigned seed = 1, int patches = 0);
+
+	Halide::Image<uint8_t> frame(int i) const;
+
+	int frames() const { return (int)m_scroll.size() + 1; }
+
+	// page rows visible between header and footer
+	int content() const { return m_height - m_header - m_footer; }
+
+	// rows shared by the content of frame i and i + 1
+	int overlap(int i) const { return content() - m_scroll[i]; }
+
+	// height of the stitched result
+	int resultHeight() const { return m_page.height() + m_header + m_footer; }
+
+	int m_width, m_height, m_header, m_footer, m_patches;
+
+private:
+	unsigned m_seed;
+
+	// page rows frame i + 1 is scrolled past frame i
+	std::vector<int> m_scroll;
+	Halide::Image<uint8_t> m_page;
+};
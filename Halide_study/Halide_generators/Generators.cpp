@@ -0,0 +1,51 @@
+/************************************************************************/
+/* Generators:
+	ahead of time compiled versions of HalidePipelines. the post build
+	step of this project runs every generator for the host target and
+	packs the objects into generated\halide_study_aot.lib
+*/
+/************************************************************************/
+
+#include "Halide.h"
+#include "../Halide_study/HalidePipelines.h"
+
+using namespace Halide;
+
+class SumRowGenerator : public Generator<SumRowGenerator>
+{
+public:
+	ImageParam input{ UInt(8), 3, "input" };
+
+	Func build()
+	{
+		return HalidePipelines::sumRow(input);
+	}
+};
+
+class RowPrefixSumGenerator : public Generator<RowPrefixSumGenerator>
+{
+public:
+	ImageParam input{ UInt(8), 3, "input" };
+
+	Func build()
+	{
+		return HalidePipelines::rowPrefixSum(input);
+	}
+};
+
+class PrefixBlockSumsGenerator : public Generator<PrefixBlockSumsGenerator>
+{
+public:
+	ImageParam prefix{ type_of<BlockSum>(), 3, "prefix" };
+	Param<int> block_width{ "block_width" };
+	Param<int> head{ "head" };
+
+	Func build()
+	{
+		return HalidePipelines::prefixBlockSums(prefix, block_width, head);
+	}
+};
+
+RegisterGenerator<SumRowGenerator> register_sum_row{ "sum_row" };
+RegisterGenerator<RowPrefixSumGenerator> register_row_prefix_sum{ "row_prefix_sum" };
+RegisterGenerator<PrefixBlockSumsGenerator> register_prefix_block_sums{ "prefix_block_sums" };
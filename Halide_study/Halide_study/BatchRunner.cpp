@@ -0,0 +1,363 @@
+/************************************************************************/
+/* BatchRunner:
+	stitch many independent jobs in one process. jobs come from a manifest
+	or a spool directory and run concurrently on one shared ThreadPool,
+	so startup and JIT compilation are paid once.
+	job format, one per line: output frame1 frame2 ... ("" quote paths
+	with spaces, # starts a comment)
+*/
+/************************************************************************/
+
+#include "stdafx.h"
+#include "BatchRunner.h"
+#include "ImageMatchMerge.h"
+#include "PngRowSink.h"
+#include <io.h>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+
+using namespace std;
+
+BatchRunner::BatchRunner(int jobs, int threads, size_t job_memory)
+	: m_succeeded(0), m_failed(0), m_signature_cache(NULL), m_pyramid_levels(0), m_pool(threads), m_job_memory(job_memory),
+	m_queued(0), m_active(0), m_stop(false)
+{
+	if (jobs <= 0)
+		jobs = max(1, m_pool.size() / 2);
+
+	for (int i = 0; i < jobs; ++i)
+	{
+		m_runners.push_back(thread(&BatchRunner::runner, this));
+	}
+}
+
+BatchRunner::~BatchRunner()
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_queue_cond.notify_all();
+
+	for (size_t i = 0; i < m_runners.size(); ++i)
+	{
+		m_runners[i].join();
+	}
+}
+
+bool BatchRunner::parseJob(const std::string& line, BatchJob& job)
+{
+	vector<string> tokens;
+	size_t i = 0;
+	while (i < line.size())
+	{
+		if (isspace((unsigned char)line[i]))
+		{
+			++i;
+			continue;
+		}
+		if (line[i] == '#')
+			break;
+
+		string token;
+		if (line[i] == '"')
+		{
+			size_t end = line.find('"', i + 1);
+			if (end == string::npos)
+				return false;
+			token = line.substr(i + 1, end - i - 1);
+			i = end + 1;
+		}
+		else
+		{
+			size_t end = i;
+			while (end < line.size() && !isspace((unsigned char)line[end]))
+				++end;
+			token = line.substr(i, end - i);
+			i = end;
+		}
+		tokens.push_back(token);
+	}
+
+	// a quoted "@..." is a path
+	job.owner.clear();
+	const size_t first = line.find_first_not_of(" \t\r");
+	if (!tokens.empty() && tokens[0].size() > 1 && line[first] == '@')
+	{
+		job.owner = tokens[0].substr(1);
+		tokens.erase(tokens.begin());
+	}
+
+	if (tokens.size() < 2)
+		return false;
+
+	job.output = tokens[0];
+	job.frames.assign(tokens.begin() + 1, tokens.end());
+	return true;
+}
+
+bool BatchRunner::loadManifest(const std::string& filename, std::vector<BatchJob>& jobs)
+{
+	ifstream in(filename);
+	if (!in)
+		return false;
+
+	string line;
+	int line_no = 0;
+	while (getline(in, line))
+	{
+		++line_no;
+		BatchJob job;
+		const size_t first = line.find_first_not_of(" \t\r");
+		if (parseJob(line, job))
+		{
+			jobs.push_back(job);
+		}
+		else if (first != string::npos && line[first] != '#')
+		{
+			printf("%s:%d: expected output and at least one frame\n", filename.c_str(), line_no);
+			return false;
+		}
+	}
+	return true;
+}
+
+void BatchRunner::submit(const BatchJob& job)
+{
+	Pending pending;
+	pending.job = job;
+	enqueue(pending);
+}
+
+void BatchRunner::enqueue(const Pending& pending)
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		deque<Pending>& queue = m_queues[pending.job.owner];
+		if (queue.empty())
+			m_turns.push_back(pending.job.owner);
+		queue.push_back(pending);
+		++m_queued;
+	}
+	m_queue_cond.notify_one();
+}
+
+BatchRunner::Pending BatchRunner::take()
+{
+	// the owner goes to the back of the turns if it has more jobs queued
+	const string owner = m_turns.front();
+	m_turns.pop_front();
+	deque<Pending>& queue = m_queues[owner];
+	Pending pending = queue.front();
+	queue.pop_front();
+	if (queue.empty())
+		m_queues.erase(owner);
+	else
+		m_turns.push_back(owner);
+	--m_queued;
+	return pending;
+}
+
+void BatchRunner::wait()
+{
+	unique_lock<mutex> lock(m_mutex);
+	m_idle_cond.wait(lock, [this] { return m_queued == 0 && m_active == 0; });
+}
+
+int BatchRunner::runManifest(const std::string& filename)
+{
+	vector<BatchJob> jobs;
+	if (!loadManifest(filename, jobs))
+		return -1;
+
+	const int failed = m_failed;
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		submit(jobs[i]);
+	}
+	wait();
+
+	return m_failed - failed;
+}
+
+void BatchRunner::runSpool(const std::string& dir, int poll_ms)
+{
+	const string stop_file = dir + "/stop";
+
+	while (_access(stop_file.c_str(), 0) != 0)
+	{
+		// claim only what the runners can start soon, other daemons may share the spool
+		size_t queued;
+		{
+			lock_guard<mutex> lock(m_mutex);
+			queued = m_queued;
+		}
+
+		vector<string> names;
+		if (queued < m_runners.size())
+		{
+			_finddata_t data;
+			intptr_t handle = _findfirst((dir + "/*.job").c_str(), &data);
+			if (handle != -1)
+			{
+				do
+				{
+					names.push_back(data.name);
+				} while (_findnext(handle, &data) == 0);
+				_findclose(handle);
+			}
+			sort(names.begin(), names.end());
+		}
+
+		for (size_t i = 0; i < names.size() && queued < m_runners.size(); ++i)
+		{
+			const string job_file = dir + "/" + names[i];
+			const string base = job_file.substr(0, job_file.size() - 4);
+
+			Pending pending;
+			pending.claim = base + ".running";
+			if (rename(job_file.c_str(), pending.claim.c_str()) != 0)
+				continue;
+
+			string line;
+			ifstream in(pending.claim);
+			while (getline(in, line) && !parseJob(line, pending.job))
+			{
+			}
+			in.close();
+
+			if (pending.job.frames.empty())
+			{
+				printf("%s: no job found\n", job_file.c_str());
+				rename(pending.claim.c_str(), (base + ".failed").c_str());
+				continue;
+			}
+
+			enqueue(pending);
+			++queued;
+		}
+
+		this_thread::sleep_for(chrono::milliseconds(poll_ms));
+	}
+
+	wait();
+}
+
+void BatchRunner::runner()
+{
+	// one pool per worker, so what a job keeps is held to one job's budget.
+	// frames and sums are recycled across the jobs of this worker
+	BufferPool buffers(m_job_memory);
+
+	unique_lock<mutex> lock(m_mutex);
+	while (true)
+	{
+		m_queue_cond.wait(lock, [this] { return m_stop || m_queued > 0; });
+		if (m_queued == 0)
+			return;
+
+		Pending pending = take();
+		++m_active;
+		lock.unlock();
+
+		// wall time, jobs run side by side on the shared pool
+		const double begin = StageTimer::wallMs();
+		bool ok = runJob(pending.job, buffers);
+		float elapsed_time = float(StageTimer::wallMs() - begin) / 1000;
+		printf("%s %s, %d frames, %f s\n", pending.job.output.c_str(), ok ? "done" : "FAILED",
+			(int)pending.job.frames.size(), elapsed_time);
+
+		if (!pending.claim.empty())
+		{
+			const string base = pending.claim.substr(0, pending.claim.size() - 8);
+			rename(pending.claim.c_str(), (base + (ok ? ".done" : ".failed")).c_str());
+		}
+
+		lock.lock();
+		if (ok)
+			++m_succeeded;
+		else
+			++m_failed;
+		--m_active;
+		if (m_queued == 0 && m_active == 0)
+			m_idle_cond.notify_all();
+	}
+}
+
+bool BatchRunner::runJob(const BatchJob& job, BufferPool& buffers)
+{
+	// the image loader exits the process on a missing file, check first
+	for (size_t i = 0; i < job.frames.size(); ++i)
+	{
+		if (_access(job.frames[i].c_str(), 4) != 0)
+		{
+			printf("%s: cannot read %s\n", job.output.c_str(), job.frames[i].c_str());
+			return false;
+		}
+	}
+
+	ImageMatchMerge merger(job.frames);
+	merger.m_pool = &m_pool;
+	merger.m_buffers = &buffers;
+	merger.m_signature_cache = m_signature_cache;
+	merger.m_pyramid_levels = m_pyramid_levels;
+
+	// streaming keeps the previous and the current frame besides the read-ahead,
+	// the budget decides how far decoding may run ahead of the matcher
+	const size_t frame = frameBytes(job.frames[0]);
+	if (frame > 0)
+	{
+		const size_t frames = m_job_memory / frame;
+		merger.m_max_decoded = (int)min<size_t>(max<size_t>(frames, 3) - 2, m_pool.size());
+	}
+
+	string ext = job.output.size() >= 4 ? job.output.substr(job.output.size() - 4) : "";
+	transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+	if (ext == ".png")
+	{
+		PngRowSink sink(job.output, Z_DEFAULT_COMPRESSION, Z_DEFAULT_STRATEGY, 
+			PngRowSink::FilterUp, frame > 0 ? frame : 64 << 20);
+		merger.runStreaming(&sink);
+		if (!m_stats_log.empty())
+			merger.m_stats.writeJsonLines(m_stats_log, job.output);
+		return sink.ok();
+	}
+
+	merger.runStreaming();
+	const bool saved = merger.saveResult(job.output);
+	if (!m_stats_log.empty())
+		merger.m_stats.writeJsonLines(m_stats_log, job.output);
+	if (!saved)
+		printf("%s: cannot write the result\n", job.output.c_str());
+	return saved;
+}
+
+size_t BatchRunner::frameBytes(const std::string& filename)
+{
+	FILE* file = fopen(filename.c_str(), "rb");
+	if (!file)
+		return 0;
+
+	uint8_t header[26];
+	const bool ok = fread(header, 1, sizeof(header), file) == sizeof(header) &&
+		memcmp(header + 12, "IHDR", 4) == 0;
+	fclose(file);
+	if (!ok)
+		return 0;
+
+	const size_t width = (header[16] << 24) | (header[17] << 16) | (header[18] << 8) | header[19];
+	const size_t height = (header[20] << 24) | (header[21] << 16) | (header[22] << 8) | header[23];
+
+	// decoded as 8 bit, gray + alpha 2 channels, color 3 or 4
+	int channels = 3;
+	switch (header[25])
+	{
+	case 0: channels = 1; break;
+	case 4: channels = 2; break;
+	case 6: channels = 4; break;
+	}
+
+	return width * height * channels;
+}
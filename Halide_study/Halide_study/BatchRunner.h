@@ -0,0 +1,106 @@
+/************************************************************************/
+/* BatchRunner:
+	stitch many independent jobs in one process. jobs come from a manifest
+	or a spool directory and run concurrently on one shared ThreadPool,
+	so startup and JIT compilation are paid once.
+	job format, one per line: [@owner] output frame1 frame2 ... ("" quote
+	paths with spaces, # starts a comment). owners take turns for job slots
+	so one large manifest or client cannot starve the others
+*/
+/************************************************************************/
+
+#pragma once
+#include <vector>
+#include <deque>
+#include <map>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "ThreadPool.h"
+#include "BufferPool.h"
+#include "SignatureCache.h"
+
+struct BatchJob
+{
+	std::string owner;	// jobs without one share the owner ""
+	std::string output;
+	std::vector<std::string> frames;
+};
+
+class BatchRunner
+{
+public:
+	// jobs: stitched at the same time (<= 0: half the pool threads).
+	// threads: shared pool size (<= 0: one per hardware thread).
+	// job_memory: bytes of decoded frames one job may hold, sets its read-ahead
+	// and caps the free buffers its worker keeps between jobs
+	BatchRunner(int jobs = 0, int threads = 0, size_t job_memory = 512 << 20);
+
+	// finishes the queued jobs
+	~BatchRunner();
+
+	static bool parseJob(const std::string& line, BatchJob& job);
+
+	static bool loadManifest(const std::string& filename, std::vector<BatchJob>& jobs);
+
+	// a free job slot goes to the next owner in turn with queued jobs, the
+	// jobs of one owner start in submission order
+	void submit(const BatchJob& job);
+
+	// block until every submitted job has finished
+	void wait();
+
+	// stitch every job of the manifest, returns the failed count (-1: bad manifest)
+	int runManifest(const std::string& filename);
+
+	// claim dir/*.job files (renamed to .running, then .done or .failed) until
+	// a file named dir/stop appears
+	void runSpool(const std::string& dir, int poll_ms = 1000);
+
+	int threads() const { return m_pool.size(); }
+
+	int m_succeeded, m_failed;
+
+	// when set, the stats of every job are appended here as JSON lines
+	std::string m_stats_log;
+
+	// shared by every job when set, re-submitted frames skip their signature pass
+	SignatureCache* m_signature_cache;
+
+	// ImageMatchMerge::m_pyramid_levels of every job
+	int m_pyramid_levels;
+
+private:
+	struct Pending
+	{
+		BatchJob job;
+		std::string claim;	// spool file to rename when done, may be empty
+	};
+
+	void enqueue(const Pending& pending);
+
+	// next job of the owner in turn, m_mutex held and m_queued > 0
+	Pending take();
+
+	void runner();
+
+	// buffers: the pool of the calling worker, frames and sums of its jobs
+	bool runJob(const BatchJob& job, BufferPool& buffers);
+
+	// decoded size of a PNG frame from its header, 0 if unknown
+	static size_t frameBytes(const std::string& filename);
+
+	ThreadPool m_pool;
+	const size_t m_job_memory;
+	std::vector<std::thread> m_runners;
+
+	// queued jobs per owner, and the owners with queued jobs in turn order
+	std::map<std::string, std::deque<Pending> > m_queues;
+	std::deque<std::string> m_turns;
+	size_t m_queued;
+	int m_active;
+	bool m_stop;
+	std::mutex m_mutex;
+	std::condition_variable m_queue_cond, m_idle_cond;
+};
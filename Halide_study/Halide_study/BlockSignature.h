@@ -0,0 +1,71 @@
+/************************************************************************/
+/* BlockSignature:
+	compile time choice of the integer types holding block sums and
+	block keys. a block sum of BlockWidth 8 bit pixels, or a key packing
+	Channels of them, is stored in the narrowest of uint16/32/64 it fits
+*/
+/************************************************************************/
+
+#pragma once
+#include <stdint.h>
+#include <type_traits>
+
+// widest block a key is built from
+#ifndef SIGNATURE_BLOCK_WIDTH
+#define SIGNATURE_BLOCK_WIDTH 20
+#endif
+
+// channels packed into one key, frames with fewer repeat their last channel
+#ifndef SIGNATURE_CHANNELS
+#define SIGNATURE_CHANNELS 3
+#endif
+
+// PyramidMatch adds the keys of up to 2^levels rows lane by lane, every
+// lane keeps room for that. fewer levels (or channels) give narrower keys
+#ifndef SIGNATURE_PYRAMID_LEVELS
+#define SIGNATURE_PYRAMID_LEVELS 8
+#endif
+
+// bits needed to hold v
+constexpr int signatureBits(uint64_t v)
+{
+	return v ? 1 + signatureBits(v >> 1) : 0;
+}
+
+template<int Bits>
+struct SignatureUnsigned
+{
+	static_assert(Bits <= 64, "signature does not fit 64 bits");
+
+	typedef typename std::conditional<Bits <= 16, uint16_t,
+		typename std::conditional<Bits <= 32, uint32_t, uint64_t>::type>::type type;
+};
+
+template<int BlockWidth, int Channels = 1, int Rows = 1>
+struct BlockSignature
+{
+	static const uint64_t kMaxSum = 255ull * BlockWidth * Rows;
+	static const int kLaneBits = signatureBits(kMaxSum);
+	static const int kKeyBits = kLaneBits * Channels;
+
+	typedef typename SignatureUnsigned<kLaneBits>::type Sum;
+	typedef typename SignatureUnsigned<kKeyBits>::type Key;
+
+	// channel sums c[0 .. Channels) one lane each, equal keys <=> equal sums
+	static Key pack(const uint32_t* c)
+	{
+		Key key = 0;
+		for (int k = 0; k < Channels; ++k)
+		{
+			key |= Key(c[k]) << (k * kLaneBits);
+		}
+		return key;
+	}
+};
+
+// block sum images, one sum of at most SIGNATURE_BLOCK_WIDTH pixels each
+typedef BlockSignature<SIGNATURE_BLOCK_WIDTH>::Sum BlockSum;
+
+// keys of RowFingerprint
+typedef BlockSignature<SIGNATURE_BLOCK_WIDTH, SIGNATURE_CHANNELS,
+	(1 << SIGNATURE_PYRAMID_LEVELS)> FingerprintSignature;
@@ -0,0 +1,76 @@
+/************************************************************************/
+/* BufferPool:
+	free list of Halide images keyed by element type and shape. every
+	frame of a job has the same size, so prefix sums and block sums of
+	one frame are served from the buffers released by the previous one
+*/
+/************************************************************************/
+
+#include "stdafx.h"
+#include "BufferPool.h"
+
+using namespace std;
+
+static thread_local size_t t_misses = 0;
+
+BufferPool::BufferPool(size_t max_bytes)
+	: m_max_bytes(max_bytes), m_free_bytes(0), m_misses(0)
+{
+}
+
+bool BufferPool::take(const Shape& shape, Halide::Buffer& buf)
+{
+	lock_guard<mutex> lock(m_mutex);
+	vector<Halide::Buffer>& list = m_free[shape];
+	if (list.empty())
+	{
+		++m_misses;
+		++t_misses;
+		return false;
+	}
+
+	buf = list.back();
+	list.pop_back();
+	m_free_bytes -= bytes(shape);
+	return true;
+}
+
+void BufferPool::give(const Shape& shape, const Halide::Buffer& buf)
+{
+	const size_t size = bytes(shape);
+	lock_guard<mutex> lock(m_mutex);
+	if (m_free_bytes + size > m_max_bytes)
+		return;
+
+	m_free[shape].push_back(buf);
+	m_free_bytes += size;
+}
+
+size_t BufferPool::bytes(const Shape& shape)
+{
+	return size_t(shape.bits / 8) * shape.width * max(1, shape.height) * max(1, shape.channels);
+}
+
+size_t BufferPool::misses() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_misses;
+}
+
+size_t BufferPool::threadMisses()
+{
+	return t_misses;
+}
+
+size_t BufferPool::freeBytes() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_free_bytes;
+}
+
+void BufferPool::clear()
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_free.clear();
+	m_free_bytes = 0;
+}
@@ -0,0 +1,85 @@
+/************************************************************************/
+/* BufferPool:
+	free list of Halide images keyed by element type and shape. every
+	frame of a job has the same size, so prefix sums and block sums of
+	one frame are served from the buffers released by the previous one
+*/
+/************************************************************************/
+
+#pragma once
+#include <map>
+#include <vector>
+#include <mutex>
+#include "Halide.h"
+
+class BufferPool
+{
+public:
+	// free buffers beyond max_bytes are dropped on release instead of kept
+	explicit BufferPool(size_t max_bytes = size_t(256) << 20);
+
+	// image of the shape, a released one when there is one, contents undefined
+	template<typename T>
+	Halide::Image<T> acquire(int width, int height, int channels)
+	{
+		const Shape shape = { int(Halide::type_of<T>().code), Halide::type_of<T>().bits, width, height, channels };
+		Halide::Buffer buf;
+		if (take(shape, buf))
+			return Halide::Image<T>(buf);
+		return Halide::Image<T>(width, height, channels);
+	}
+
+	// hand image back and reset it. nothing else may still use its pixels
+	template<typename T>
+	void release(Halide::Image<T>& image)
+	{
+		if (!image.defined())
+			return;
+		const Shape shape = { int(Halide::type_of<T>().code), Halide::type_of<T>().bits, 
+			image.width(), image.height(), image.channels() };
+		give(shape, image);
+		image = Halide::Image<T>();
+	}
+
+	// misses: images allocated because no free one fitted
+	size_t misses() const;
+
+	// the same, counted for the calling thread over all pools
+	static size_t threadMisses();
+
+	size_t freeBytes() const;
+
+	void clear();
+
+private:
+	struct Shape
+	{
+		int code, bits, width, height, channels;
+
+		bool operator<(const Shape& o) const
+		{
+			if (code != o.code)
+				return code < o.code;
+			if (bits != o.bits)
+				return bits < o.bits;
+			if (width != o.width)
+				return width < o.width;
+			if (height != o.height)
+				return height < o.height;
+			return channels < o.channels;
+		}
+	};
+
+	bool take(const Shape& shape, Halide::Buffer& buf);
+
+	void give(const Shape& shape, const Halide::Buffer& buf);
+
+	static size_t bytes(const Shape& shape);
+
+	// free lists stay in the map when they run empty, so a steady state
+	// of acquire/release does not allocate map nodes or vector storage
+	std::map<Shape, std::vector<Halide::Buffer> > m_free;
+	const size_t m_max_bytes;
+	size_t m_free_bytes, m_misses;
+	mutable std::mutex m_mutex;
+};
@@ -0,0 +1,83 @@
+/************************************************************************/
+/* Compositor:
+	table of segments (source rows and destination row) of the output,
+	copied in parallel with contiguous moves, each output byte written once
+*/
+/************************************************************************/
+
+#include "stdafx.h"
+#include "Compositor.h"
+
+using namespace std;
+
+// bytes copied by one task at most
+static const int kTaskBytes = 1 << 20;
+
+void Compositor::add(const ImageView<uint8_t>& src, int dst_y)
+{
+	if (src.height() <= 0)
+		return;
+
+	Segment seg = { src, dst_y };
+	m_segments.push_back(seg);
+}
+
+int Compositor::height() const
+{
+	int res = 0;
+	for (size_t i = 0; i < m_segments.size(); ++i)
+	{
+		res = max(res, m_segments[i].dst_y + m_segments[i].src.height());
+	}
+	return res;
+}
+
+void Compositor::blit(const ImageView<uint8_t>& dst, ThreadPool& pool) const
+{
+	assert(dst.height() >= height());
+
+	// split every segment into row chunks
+	struct Chunk
+	{
+		const Segment* seg;
+		int y, rows;
+	};
+	vector<Chunk> chunks;
+	const int chunk_rows = max(1, kTaskBytes / max(1, dst.width() * dst.channels()));
+	for (size_t i = 0; i < m_segments.size(); ++i)
+	{
+		const Segment& seg = m_segments[i];
+		for (int y = 0; y < seg.src.height(); y += chunk_rows)
+		{
+			Chunk chunk = { &seg, y, min(chunk_rows, seg.src.height() - y) };
+			chunks.push_back(chunk);
+		}
+	}
+
+	pool.parallelFor((int)chunks.size(), [&](int i)
+	{
+		const Chunk& chunk = chunks[i];
+		copyRows(dst.crop(chunk.seg->dst_y + chunk.y, chunk.rows), chunk.seg->src.crop(chunk.y, chunk.rows));
+	});
+}
+
+void Compositor::copyRows(const ImageView<uint8_t>& dst, const ImageView<uint8_t>& src)
+{
+	const int width = dst.width(), rows = dst.height();
+	assert(src.width() == width && src.height() == rows && src.channels() == dst.channels());
+	for (int c = 0; c < dst.channels(); ++c)
+	{
+		uint8_t* d = &dst(0, 0, c);
+		const uint8_t* s = &src(0, 0, c);
+		if (dst.stride(1) == width && src.stride(1) == width)
+		{
+			memcpy(d, s, size_t(rows) * width);
+			continue;
+		}
+
+		for (int y = 0; y < rows; ++y)
+		{
+			memcpy(d + size_t(y) * dst.stride(1), s + size_t(y) * src.stride(1), width);
+		}
+	}
+}
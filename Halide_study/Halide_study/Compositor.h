@@ -0,0 +1,36 @@
+/************************************************************************/
+/* Compositor:
+	table of segments (source rows and destination row) of the output,
+	copied in parallel with contiguous moves, each output byte written once
+*/
+/************************************************************************/
+
+#pragma once
+#include <vector>
+#include "Halide.h"
+#include "ImageView.h"
+#include "ThreadPool.h"
+
+class Compositor
+{
+public:
+	struct Segment
+	{
+		ImageView<uint8_t> src;
+		int dst_y;
+	};
+
+	// all rows of src go to rows [dst_y, dst_y + src.height()) of the output
+	void add(const ImageView<uint8_t>& src, int dst_y);
+
+	// rows covered by the segments
+	int height() const;
+
+	// copy every segment into dst, which must hold height() rows
+	void blit(const ImageView<uint8_t>& dst, ThreadPool& pool) const;
+
+	// copy src to dst, both the same size
+	static void copyRows(const ImageView<uint8_t>& dst, const ImageView<uint8_t>& src);
+
+	std::vector<Segment> m_segments;
+};
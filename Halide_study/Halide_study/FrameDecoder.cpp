@@ -0,0 +1,235 @@
+/************************************************************************/
+/* FrameDecoder:
+	decode image files concurrently on a ThreadPool and hand them out in
+	file order, with at most max_in_flight frames decoded ahead. PNG rows
+	can be keyed as they are decoded, saving a second pass over the frame
+*/
+/************************************************************************/
+
+#include "stdafx.h"
+#include "FrameDecoder.h"
+#include "PngRowSource.h"
+#include "RowPrefixSum.h"
+
+using namespace std;
+using namespace Halide::Tools;
+
+// widths of the keys a cache entry holds
+static const vector<int> kCacheWidths = { 10, 20 };
+
+void FrameDecoder::Keys::clear()
+{
+	sums.clear();
+	sums20.clear();
+	head = tail = 0;
+}
+
+FrameDecoder::FrameDecoder(const std::vector<std::string>& files, ThreadPool& pool, int max_in_flight,
+	BufferPool* buffers, int full_frames, SignatureCache* cache)
+	: m_files(files), m_pool(pool), m_max_in_flight(max(1, max_in_flight)),
+	m_buffers(buffers), m_full_frames(full_frames), m_cache(cache),
+	m_frames(files.size()), m_keys(files.size()), m_ready(files.size(), false), 
+	m_next_submit(0), m_next_take(0), m_pending(0), m_head(0), m_tail(0), m_cut(false), 
+	m_pool_misses(0)
+{
+	lock_guard<mutex> lock(m_mutex);
+	schedule();
+}
+
+FrameDecoder::~FrameDecoder()
+{
+	unique_lock<mutex> lock(m_mutex);
+	m_cond.wait(lock, [this] { return m_pending == 0; });
+}
+
+void FrameDecoder::setCut(int head, int tail)
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_head = head;
+	m_tail = tail;
+	m_cut = true;
+}
+
+Halide::Image<uint8_t> FrameDecoder::next(Keys* keys)
+{
+	unique_lock<mutex> lock(m_mutex);
+	assert(!done());
+
+	const int index = m_next_take++;
+	m_cond.wait(lock, [this, index] { return (bool)m_ready[index]; });
+
+	Halide::Image<uint8_t> frame = m_frames[index];
+	m_frames[index] = Halide::Image<uint8_t>();
+	if (keys)
+		swap(*keys, m_keys[index]);
+	m_spare_keys.emplace_back();
+	swap(m_spare_keys.back(), m_keys[index]);
+	schedule();
+	return frame;
+}
+
+size_t FrameDecoder::poolMisses()
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_pool_misses;
+}
+
+void FrameDecoder::schedule()
+{
+	while (m_next_submit < (int)m_files.size() && m_next_submit - m_next_take < m_max_in_flight)
+	{
+		const int index = m_next_submit++;
+		++m_pending;
+		m_pool.submit([this, index] { decode(index); });
+	}
+}
+
+void FrameDecoder::decode(int index)
+{
+	Keys keys;
+	int head = -1, tail = 0;
+	{
+		lock_guard<mutex> lock(m_mutex);
+		if (!m_spare_keys.empty())
+		{
+			swap(keys, m_spare_keys.back());
+			m_spare_keys.pop_back();
+		}
+		if (index >= m_full_frames)
+		{
+			head = m_cut ? m_head : 0;
+			tail = m_cut ? m_tail : 0;
+		}
+	}
+
+	const size_t misses = BufferPool::threadMisses();
+	Halide::Image<uint8_t> frame = load(m_files[index], m_buffers, keys, head, tail, m_cache);
+
+	lock_guard<mutex> lock(m_mutex);
+	m_pool_misses += BufferPool::threadMisses() - misses;
+	m_frames[index] = frame;
+	swap(m_keys[index], keys);
+	m_ready[index] = true;
+	--m_pending;
+	m_cond.notify_all();
+}
+
+// full keys of the frame's size, guards against a hash collision
+static bool keysFit(const Halide::Image<uint8_t>& frame, const FrameDecoder::Keys& keys)
+{
+	return keys.head == 0 && keys.tail == 0 && 
+		keys.sums.height() == frame.height() && keys.sums.width() == (frame.width() + 9) / 10 &&
+		keys.sums20.height() == frame.height() && keys.sums20.width() == (frame.width() + 19) / 20;
+}
+
+Halide::Image<uint8_t> FrameDecoder::load(const std::string& filename, BufferPool* buffers,
+	Keys& keys, int head, int tail, SignatureCache* cache)
+{
+	const uint64_t hash = cache ? SignatureCache::hashFile(filename) : 0;
+	if (!hash)
+		return decodeKeyed(filename, buffers, keys, head, tail, true);
+
+	// the cache holds full keys of both widths, whatever the cut: a hit only
+	// needs the pixels, a miss builds everything for the next run
+	vector<RowFingerprint> both(kCacheWidths.size());
+	Halide::Image<uint8_t> frame;
+	if (cache->load(hash, kCacheWidths, both))
+	{
+		keys.clear();
+		swap(keys.sums, both[0]);
+		swap(keys.sums20, both[1]);
+		frame = decodeKeyed(filename, buffers, keys, -1, 0, false);
+		if (keysFit(frame, keys))
+			return frame;
+		keys.clear();
+	}
+	else
+		frame = decodeKeyed(filename, buffers, keys, -1, 0, true);
+
+	// formats other than PNG are keyed by the prefix sum pass, so every
+	// frame leaves keys behind for the next run
+	if (keys.empty())
+	{
+		RowPrefixSum prefix(frame, buffers);
+		for (int i = 0; i < 2; ++i)
+		{
+			Halide::Image<BlockSum> block_sums = prefix.blockSums(kCacheWidths[i]);
+			(i ? keys.sums20 : keys.sums).build(block_sums);
+			if (buffers)
+				buffers->release(block_sums);
+		}
+	}
+	swap(keys.sums, both[0]);
+	swap(keys.sums20, both[1]);
+	cache->store(hash, frame.width(), kCacheWidths, both);
+	swap(keys.sums, both[0]);
+	swap(keys.sums20, both[1]);
+	return frame;
+}
+
+Halide::Image<uint8_t> FrameDecoder::decodeKeyed(const std::string& filename, BufferPool* buffers,
+	Keys& keys, int head, int tail, bool keyed)
+{
+	if (keyed)
+		keys.clear();
+	PngRowSource source(filename, &keys.png_row);
+	if (!source.ok())
+		return load_image(filename);
+
+	const int width = source.width(), height = source.height(), channels = source.channels();
+	Halide::Image<uint8_t> frame = buffers ? buffers->acquire<uint8_t>(width, height, channels) :
+		Halide::Image<uint8_t>(width, height, channels);
+
+	// a cut that leaves no rows keys them all
+	const bool full = head < 0;
+	if (full || head + tail >= height)
+		head = tail = 0;
+	const int blocks = (width + 9) / 10, blocks20 = (blocks + 1) / 2;
+	uint32_t* sums = NULL;
+	uint32_t* sums20 = NULL;
+	if (keyed)
+	{
+		if (full)
+			keys.sums.resize(blocks, height);
+		keys.sums20.resize(blocks20, height - head - tail);
+		keys.head = head;
+		keys.tail = tail;
+		keys.row_sums.resize(size_t(blocks + blocks20) * channels);
+		sums = keys.row_sums.data();
+		sums20 = sums + blocks * channels;
+	}
+
+	uint8_t* planes = frame.data();
+	const int row_stride = frame.stride(1), plane_stride = frame.stride(2);
+	const bool ok = source.read([&](int y, const uint8_t* pixels)
+	{
+		// one pass over the pixels, the 20 pixel blocks pair the 10 pixel ones
+		if (keyed && y >= head && y < height - tail)
+		{
+			RowFingerprint::sumBlocks(pixels, width, channels, 10, sums);
+			if (full)
+				keys.sums.setRow(y, sums, channels);
+			RowFingerprint::pairBlocks(sums, blocks, channels, sums20);
+			keys.sums20.setRow(y - head, sums20, channels);
+		}
+		for (int c = 0; c < channels; ++c)
+		{
+			uint8_t* out = planes + y * row_stride + c * plane_stride;
+			for (int x = 0; x < width; ++x)
+			{
+				out[x] = pixels[x * channels + c];
+			}
+		}
+	});
+
+	// a truncated file gets the error handling of load_image
+	if (!ok)
+	{
+		if (keyed)
+			keys.clear();
+		if (buffers)
+			buffers->release(frame);
+		return load_image(filename);
+	}
+	return frame;
+}
@@ -0,0 +1,103 @@
+/************************************************************************/
+/* FrameDecoder:
+	decode image files concurrently on a ThreadPool and hand them out in
+	file order, with at most max_in_flight frames decoded ahead. PNG rows
+	can be keyed as they are decoded, saving a second pass over the frame
+*/
+/************************************************************************/
+
+#pragma once
+#include <vector>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include "Halide.h"
+#include "ThreadPool.h"
+#include "BufferPool.h"
+#include "RowFingerprint.h"
+#include "SignatureCache.h"
+
+class FrameDecoder
+{
+public:
+	// keys built while a frame is decoded. next() takes the caller's Keys in
+	// exchange, so their storage serves a later frame instead of being freed
+	struct Keys
+	{
+		Keys() : head(0), tail(0) {}
+
+		// 10 pixel blocks of the whole frame, empty unless asked for
+		RowFingerprint sums;
+
+		// 20 pixel blocks of rows [head, height - tail)
+		RowFingerprint sums20;
+		int head, tail;
+
+		bool empty() const { return sums20.height() == 0; }
+
+		void clear();
+
+		// scratch of one decode, travels with the keys to be reused as well
+		std::vector<uint32_t> row_sums;
+		std::vector<uint8_t> png_row;
+	};
+
+	// buffers: frames decoded row by row are drawn from it, may be NULL.
+	// full_frames: frames before it get 10 pixel keys too, later ones 20 pixel keys only.
+	// cache: keys are looked up there first and stored there when built, may be NULL
+	FrameDecoder(const std::vector<std::string>& files, ThreadPool& pool, int max_in_flight,
+		BufferPool* buffers = NULL, int full_frames = 2, SignatureCache* cache = NULL);
+
+	// waits for the tasks still running
+	~FrameDecoder();
+
+	// frames after full_frames whose decode starts from now on key rows
+	// [head, height - tail) only. those already decoding keep every row
+	void setCut(int head, int tail);
+
+	// next frame in file order, blocks until it is decoded. keys is exchanged
+	// for the decode time keys, empty when the file had to go to load_image
+	Halide::Image<uint8_t> next(Keys* keys = NULL);
+
+	// decode one file. head < 0: 10 and 20 pixel keys of every row, else 20
+	// pixel keys of rows [head, height - tail) only. keys are built from the rows
+	// while they are in cache when it is an 8 bit RGB(A) PNG, left empty otherwise.
+	// with a cache the full keys of every format come from it, or are built and stored
+	static Halide::Image<uint8_t> load(const std::string& filename, BufferPool* buffers,
+		Keys& keys, int head = -1, int tail = 0, SignatureCache* cache = NULL);
+
+	bool done() const { return m_next_take >= (int)m_files.size(); }
+
+	// BufferPool misses of the decode tasks so far
+	size_t poolMisses();
+
+private:
+	// start decodes until max_in_flight frames are pending or taken, m_mutex held
+	void schedule();
+
+	void decode(int index);
+
+	// load() without the cache, keyed false leaves keys alone
+	static Halide::Image<uint8_t> decodeKeyed(const std::string& filename, BufferPool* buffers,
+		Keys& keys, int head, int tail, bool keyed);
+
+	std::vector<std::string> m_files;
+	ThreadPool& m_pool;
+	const int m_max_in_flight;
+	BufferPool* m_buffers;
+	const int m_full_frames;
+	SignatureCache* m_cache;
+
+	std::vector<Halide::Image<uint8_t> > m_frames;
+	std::vector<Keys> m_keys;
+
+	// keys handed back by next(), taken by the next decodes
+	std::vector<Keys> m_spare_keys;
+	std::vector<bool> m_ready;
+	int m_next_submit, m_next_take, m_pending;
+	int m_head, m_tail;
+	bool m_cut;
+	size_t m_pool_misses;
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+};
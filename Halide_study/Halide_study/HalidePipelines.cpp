@@ -0,0 +1,56 @@
+/************************************************************************/
+/* HalidePipelines:
+	definitions and schedules of the Halide pipelines, shared by the JIT
+	path and the ahead of time generators (Halide_generators project).
+	with HALIDE_AOT defined the compiled functions are called instead
+*/
+/************************************************************************/
+
+#include "stdafx.h"
+#include "HalidePipelines.h"
+#include <stdlib.h>
+
+using namespace Halide;
+
+Func HalidePipelines::sumRow(const ImageParam& input)
+{
+	Var y("y"), c("c");
+	Func f("sum_row");
+	RDom r(0, input.width());
+	f(c, y) = sum(cast<uint32_t>(input(r, y, c)));
+	f.parallel(y);
+	return f;
+}
+
+Func HalidePipelines::rowPrefixSum(const ImageParam& input)
+{
+	Var x("x"), y("y"), c("c");
+	Func f("row_prefix_sum");
+	RDom r(1, input.width());
+	f(x, y, c) = cast<BlockSum>(0);
+	f(r, y, c) = f(r - 1, y, c) + cast<BlockSum>(input(r - 1, y, c));
+
+	f.reorder(x, c, y).parallel(y);
+	f.update(0).reorder(r.x, c, y).parallel(y);
+	return f;
+}
+
+Func HalidePipelines::prefixBlockSums(const ImageParam& prefix, 
+	const Param<int>& block_width, const Param<int>& head)
+{
+	Var b("b"), y("y"), c("c");
+	Expr width = prefix.width() - 1;
+	Func f("prefix_block_sums");
+	f(b, y, c) = prefix(min((b + 1) * block_width, width), y + head, c) -
+		prefix(b * block_width, y + head, c);
+	f.reorder(b, c, y).vectorize(b, 8).parallel(y);
+	return f;
+}
+
+void HalidePipelines::check(int result, const char* name)
+{
+	if (result == 0)
+		return;
+	fprintf(stderr, "%s failed with error %d\n", name, result);
+	abort();
+}
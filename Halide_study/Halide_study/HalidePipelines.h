@@ -0,0 +1,30 @@
+/************************************************************************/
+/* HalidePipelines:
+	definitions and schedules of the Halide pipelines, shared by the JIT
+	path and the ahead of time generators (Halide_generators project).
+	with HALIDE_AOT defined the compiled functions are called instead
+*/
+/************************************************************************/
+
+#pragma once
+#include "Halide.h"
+#include "BlockSignature.h"
+
+class HalidePipelines
+{
+public:
+	// (c, y) -> sum of input(x, y, c) over the row, c in 0..2
+	static Halide::Func sumRow(const Halide::ImageParam& input);
+
+	// (x, y, c) -> sum of input(0 .. x-1, y, c), x in 0..width, modulo the range
+	// of BlockSum: differences of two of them are still exact block sums
+	static Halide::Func rowPrefixSum(const Halide::ImageParam& input);
+
+	// (b, y, c) -> sum of block b of row y + head, from a rowPrefixSum result
+	static Halide::Func prefixBlockSums(const Halide::ImageParam& prefix, 
+		const Halide::Param<int>& block_width, const Halide::Param<int>& head);
+
+	// result of an ahead of time compiled call: non-zero prints the error and
+	// aborts, as realize() of the JIT path does
+	static void check(int result, const char* name);
+};
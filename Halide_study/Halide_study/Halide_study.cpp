@@ -4,10 +4,76 @@
 // The only Halide header file you need is Halide.h. It includes all of Halide.
 #include "stdafx.h"
 #include "ImageMatchMerge.h"
+#include "BatchRunner.h"
 
-
+// Halide_study                          stitch pics/1.png .. 3.png into res.png
+// Halide_study --batch manifest.txt     stitch every job of the manifest
+// Halide_study --spool dir              stitch dir/*.job until dir/stop exists
+//   --jobs N  --threads N  --job-memory MB  --stats log.jsonl  --signature-cache dir
+//   --pyramid N   coarse to fine search of overlaps that are not exact, N levels
 int main(int argc, char **argv)
 {
+	std::string manifest, spool, stats, signature_cache;
+	int jobs = 0, threads = 0, job_memory = 512, pyramid_levels = 0;
+	for (int i = 1; i < argc; i += 2)
+	{
+		std::string arg = argv[i];
+		if (i + 1 >= argc)
+		{
+			printf("missing value for %s\n", argv[i]);
+			return 1;
+		}
+		else if (arg == "--batch")
+			manifest = argv[i + 1];
+		else if (arg == "--spool")
+			spool = argv[i + 1];
+		else if (arg == "--jobs")
+			jobs = atoi(argv[i + 1]);
+		else if (arg == "--threads")
+			threads = atoi(argv[i + 1]);
+		else if (arg == "--job-memory")
+			job_memory = atoi(argv[i + 1]);
+		else if (arg == "--stats")
+			stats = argv[i + 1];
+		else if (arg == "--signature-cache")
+			signature_cache = argv[i + 1];
+		else if (arg == "--pyramid")
+			pyramid_levels = atoi(argv[i + 1]);
+		else
+		{
+			printf("unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	std::unique_ptr<SignatureCache> cache;
+	if (!signature_cache.empty())
+		cache.reset(new SignatureCache(signature_cache));
+
+	if (!manifest.empty() || !spool.empty())
+	{
+		BatchRunner runner(jobs, threads, (size_t)job_memory << 20);
+		runner.m_stats_log = stats;
+		runner.m_signature_cache = cache.get();
+		runner.m_pyramid_levels = pyramid_levels;
+		const double begin = StageTimer::wallMs();
+
+		if (!manifest.empty() && runner.runManifest(manifest) < 0)
+		{
+			printf("cannot read manifest %s\n", manifest.c_str());
+			return 1;
+		}
+		if (!spool.empty())
+			runner.runSpool(spool);
+
+		float elapsed_time = float(StageTimer::wallMs() - begin) / 1000;
+		printf("%d jobs done, %d failed, %f s, %f jobs/sec/core\n", runner.m_succeeded, runner.m_failed,
+			elapsed_time, elapsed_time > 0 ? runner.m_succeeded / elapsed_time / runner.threads() : 0.0f);
+		if (cache)
+			printf("signature cache %d hits, %d misses\n", cache->hits(), cache->misses());
+		return runner.m_failed > 0 ? 2 : 0;
+	}
+
 	ImageMatchMerge paser;
 	char filename[256];
 	for (int i = 1; i < 4; ++i)
@@ -16,7 +82,15 @@ int main(int argc, char **argv)
 		paser.m_image_files.push_back(filename);
 	}
 
+	paser.m_stats_log = stats;
+	paser.m_signature_cache = cache.get();
+	paser.m_pyramid_levels = pyramid_levels;
 	paser.run();
+	paser.m_stats.print(stdout);
 
-	paser.saveResult("res.png");
+	if (!paser.saveResult("res.png"))
+	{
+		printf("cannot write res.png\n");
+		return 1;
+	}
 }
\ No newline at end of file
@@ -5,7 +5,21 @@ match image from head to tail and merge them
 /************************************************************************/
 
 #include "stdafx.h"
+#include <atomic>
+#include <mutex>
 #include "ImageMatchMerge.h"
+#include "RowPrefixSum.h"
+#include "OverlapSearch.h"
+#include "PyramidMatch.h"
+#include "StaticRegions.h"
+#include "TaskGraph.h"
+#include "Compositor.h"
+#include "HalidePipelines.h"
+#ifdef HALIDE_AOT
+#include "sum_row.h"
+#else
+#include "PipelineCache.h"
+#endif // HALIDE_AOT
 
 using namespace std;
 using namespace Halide;
@@ -13,13 +27,17 @@ using namespace Halide::Tools;
 
 Halide::Image<uint32_t> ImageMatchMerge::sumImageRow(const Halide::Image<uint8_t>& input)
 {
-	Var x("x"), y("y"), c("c");
-	Func f;
-	RDom r(0, input.width());
-	f(c, y) = sum(cast<uint32_t>(input(r, y, c)));
-	f.parallel(y);
-	//f.trace_stores();
-	Halide::Image<uint32_t> output = f.realize(3, input.height());
+#ifdef HALIDE_AOT
+	Halide::Image<uint32_t> output(3, input.height());
+	HalidePipelines::check(sum_row(input.raw_buffer(), output.raw_buffer()), "sum_row");
+#else
+	PipelineCache::Pipeline& p = PipelineCache::instance().get("sum_row", UInt(8), input.channels(),
+		[](PipelineCache::Pipeline& p) { return HalidePipelines::sumRow(p.input); });
+	lock_guard<mutex> lock(p.mutex);
+	p.input.set(input);
+	//p.func.trace_stores();
+	Halide::Image<uint32_t> output = p.func.realize(3, input.height());
+#endif // HALIDE_AOT
 
 #ifdef DO_ASSERT
 	// assert correctness
@@ -44,57 +62,14 @@ Halide::Image<uint32_t> ImageMatchMerge::sumImageRow(const Halide::Image<uint8_t
 	return output;
 }
 
-Halide::Image<uint32_t> ImageMatchMerge::sumImageRowBlock(
-	const Halide::Image<uint8_t>& input, 
-	int block_width)
-{
-	int block = input.width() / block_width;
-	if (input.width() > block * block_width)
-		++block;
-
-	Image<uint32_t> output(block, input.height(), input.channels());
-
-	for (int j = 0; j < input.height(); j++)
-	{
-		for (int b = 0; b < block - 1; ++b)
-		{
-			uint32_t c[3] = { 0 };
-			for (int i = b*block_width; i < block_width*(b + 1); ++i)
-			{
-				for (int k = 0; k < 3; k++)
-				{
-					c[k] += input(i, j, k);
-				}
-			}
-			for (int k = 0; k < 3; k++)
-			{
-				output(b, j, k) = c[k];
-			}
-		}
-
-	}
-
-	return output;
-}
-
-std::tuple<int, int> ImageMatchMerge::findHeadAndTail(const Halide::Image<uint32_t>& sum1,
-	const Halide::Image<uint32_t>& sum2)
+std::tuple<int, int> ImageMatchMerge::findHeadAndTail(const RowFingerprint& sum1,
+	const RowFingerprint& sum2)
 {
 	int height = min(sum1.height(), sum2.height());
 	int head = 0, tail = height - 1;
 	for (; head < height; ++head)
 	{
-		bool is_equal = true;
-		for (int i = 0; i < 3; ++i)
-		{
-			if (sum1(i, head) != sum2(i, head))
-			{
-				is_equal = false;
-				break;
-			}
-		}
-
-		if (!is_equal)
+		if (!RowFingerprint::rowEqual(sum1, head, sum2, head))
 		{
 			--head;
 			break;
@@ -103,17 +78,7 @@ std::tuple<int, int> ImageMatchMerge::findHeadAndTail(const Halide::Image<uint32
 
 	for (; tail >= 0; --tail)
 	{
-		bool is_equal = true;
-		for (int i = 0; i < 3; ++i)
-		{
-			if (sum1(i, tail) != sum2(i, tail))
-			{
-				is_equal = false;
-				break;
-			}
-		}
-
-		if (!is_equal)
+		if (!RowFingerprint::rowEqual(sum1, tail, sum2, tail))
 		{
 			++tail;
 			break;
@@ -125,8 +90,8 @@ std::tuple<int, int> ImageMatchMerge::findHeadAndTail(const Halide::Image<uint32
 	return tuple<int, int>(head, tail);
 }
 
-std::tuple<int, int> findHeadAndTail2(const Halide::Image<uint32_t>& sum1,
-	const Halide::Image<uint32_t>& sum2)
+std::tuple<int, int> findHeadAndTail2(const RowFingerprint& sum1,
+	const RowFingerprint& sum2)
 {
 	const int height = min(sum1.height(), sum2.height());
 	const int width = min(sum1.width(), sum2.width());
@@ -134,14 +99,7 @@ std::tuple<int, int> findHeadAndTail2(const Halide::Image<uint32_t>& sum1,
 	int head = 0, tail = height - 1;
 	for (; head < height; ++head)
 	{
-		int match = 0;
-		for (int x = 0; x < width; ++x)
-		{
-			if (sum1(x, head, 0) == sum2(x, head, 0) &&
-				sum1(x, head, 1) == sum2(x, head, 1) &&
-				sum1(x, head, 2) == sum2(x, head, 2))
-				++match;
-		}
+		int match = RowFingerprint::countEqual(sum1.blocks(head), sum2.blocks(head), width);
 
 		if ((float)match / width < 0.5)
 		{
@@ -152,14 +110,7 @@ std::tuple<int, int> findHeadAndTail2(const Halide::Image<uint32_t>& sum1,
 
 	for (; tail >= 0; --tail)
 	{
-		int match = 0;
-		for (int x = 0; x < width; ++x)
-		{
-			if (sum1(x, tail, 0) == sum2(x, tail, 0) &&
-				sum1(x, tail, 1) == sum2(x, tail, 1) &&
-				sum1(x, tail, 2) == sum2(x, tail, 2))
-				++match;
-		}
+		int match = RowFingerprint::countEqual(sum1.blocks(tail), sum2.blocks(tail), width);
 
 		if ((float)match / width < 0.9)
 		{
@@ -174,197 +125,835 @@ std::tuple<int, int> findHeadAndTail2(const Halide::Image<uint32_t>& sum1,
 }
 
 template<typename T>
-Halide::Image<T> ImageMatchMerge::cutHeadAndTail(const Halide::Image<T>& input, int headLen, int tailLen)
+ImageView<T> ImageMatchMerge::cutHeadAndTail(const ImageView<T>& input, int headLen, int tailLen)
+{
+	return input.crop(headLen, input.height() - headLen - tailLen);
+}
+
+template ImageView<uint8_t> ImageMatchMerge::cutHeadAndTail(const ImageView<uint8_t>&, int, int);
+
+// sizes of the buffers a stage reads and writes, once per pass, for MergeStats
+static uint64_t imageBytes(const ImageView<uint8_t>& image)
 {
-	Var x("x"), y("y"), c("c");
-	const int out_height = input.height() - headLen - tailLen;
-	Func f;
-	if (input.channels() > 1)
-	{
-		f(x, y, c) = input(x, y + headLen, c);
-		Halide::Image<T> output = f.realize(input.width(), out_height, input.channels());
-		return output;
+	return uint64_t(image.width()) * image.height() * image.channels();
+}
+
+template<typename T>
+static uint64_t bufferBytes(const Halide::Image<T>& image)
+{
+	return image.defined() ? sizeof(T) * image.width() * image.height() * image.channels() : 0;
+}
+
+static uint64_t keyBytes(const RowFingerprint& keys)
+{
+	return sizeof(RowFingerprint::Key) * keys.m_blocks.size() + sizeof(uint64_t) * keys.m_rows.size();
+}
+
+// 20 pixel keys of rows [head, height - tail) out of keys built while decoding,
+// which cover those rows or more. swapped when they match, copied otherwise
+static uint64_t takeCut(FrameDecoder::Keys& keys, int head, int tail, RowFingerprint& cut)
+{
+	assert(keys.head <= head && keys.tail <= tail);
+	if (keys.head == head && keys.tail == tail)
+	{
+		swap(cut, keys.sums20);
+		return 0;
 	}
-	else
+	keys.sums20.crop(head - keys.head, tail - keys.tail, cut);
+	return 2 * keyBytes(cut);
+}
+
+uint64_t ImageMatchMerge::buildSignatures(const Halide::Image<uint8_t>& frame, RowFingerprint& sums, 
+	RowFingerprint& sums20)
+{
+	RowPrefixSum prefix(frame, &buffers());
+	uint64_t bytes = imageBytes(frame) + bufferBytes(prefix.m_prefix);
+
+	// the block sums are written from the prefix, then read into keys
+	Halide::Image<BlockSum> block_sums = prefix.blockSums(10);
+	sums.build(block_sums);
+	bytes += bufferBytes(prefix.m_prefix) + 2 * bufferBytes(block_sums) + keyBytes(sums);
+	buffers().release(block_sums);
+
+	block_sums = prefix.blockSums(20);
+	sums20.build(block_sums);
+	bytes += bufferBytes(prefix.m_prefix) + 2 * bufferBytes(block_sums) + keyBytes(sums20);
+	buffers().release(block_sums);
+	return bytes;
+}
+
+uint64_t ImageMatchMerge::buildCutSignature(const Halide::Image<uint8_t>& frame, int head, int tail, 
+	RowFingerprint& cut_sums20)
+{
+	// the prefix pass reads the cut rows in place, nothing is copied
+	const ImageView<uint8_t> cut = cutHeadAndTail<uint8_t>(frame, head, tail);
+	RowPrefixSum prefix(cut.image(), &buffers());
+	Halide::Image<BlockSum> block_sums = prefix.blockSums(20);
+	cut_sums20.build(block_sums);
+	const uint64_t bytes = imageBytes(cut) + 2 * bufferBytes(prefix.m_prefix) + 2 * bufferBytes(block_sums) + 
+		keyBytes(cut_sums20);
+	buffers().release(block_sums);
+	return bytes;
+}
+
+// (score, h) of a candidate as one integer, a larger key is the better candidate:
+// higher score first, larger h on ties, the order the sequential scan picks by.
+// scores are >= 0, so their float bits sort like their values
+static uint64_t candidateKey(float score, int h)
+{
+	uint32_t bits;
+	memcpy(&bits, &score, sizeof(bits));
+	return (uint64_t(bits) << 32) | uint32_t(h);
+}
+
+static void raiseBound(atomic<uint64_t>& best, uint64_t key)
+{
+	uint64_t cur = best.load(memory_order_relaxed);
+	while (key > cur && !best.compare_exchange_weak(cur, key, memory_order_relaxed))
 	{
-		f(x, y) = input(x, y + headLen);
-		Halide::Image<T> output = f.realize(input.width(), out_height);
-		return output;
 	}
 }
 
-template<typename T>
-inline float calcAvgMatch(const Halide::Image<T>& top, const Halide::Image<T>& down, int offset)
+// fraction of equal blocks when the last h rows of top overlap down,
+// -1 as soon as the rows left cannot lift it to the best key any more
+static float calcAvgMatch(const RowFingerprint& top, const RowFingerprint& down, int h,
+	const atomic<uint64_t>& best)
 {
+	int offset = min(top.height(), down.height()) - h;
 	const int height = min(top.height() - offset, down.height());
 	const int width = min(top.width(), down.width());
 	int match = 0;
 	for (int y = 0; y < height; ++y, ++offset)
 	{
-		for (int x = 0; x < width; ++x)
+		match += RowFingerprint::countEqual(top.blocks(offset), down.blocks(y), width);
+		if ((y & 7) == 7)
 		{
-			if (top(x, offset, 0) == down(x, y, 0) &&
-				top(x, offset, 1) == down(x, y, 1) &&
-				top(x, offset, 2) == down(x, y, 2))
-			{
-				++match;
-			}
+			float upper = float(match + (height - 1 - y) * width) / (height * width);
+			if (candidateKey(upper, h) < best.load(memory_order_relaxed))
+				return -1;
 		}
-
 	}
 	return float(match) / (height * width);
 }
 
-template<typename T>
-int ImageMatchMerge::avgMatchImages(const Halide::Image<T>& top, const Halide::Image<T>& down)
+int ImageMatchMerge::avgMatchImages(const RowFingerprint& top, const RowFingerprint& down, float* score)
 {
-	const int width = min(top.width(), down.width()), height = min(top.height(), down.height());
+	// an exact match scores 1, no other h can beat it
+	int res = OverlapSearch::findExactOverlap(top, down, OverlapSearch::LargestOverlap);
+	if (res > 0)
+	{
+		if (score)
+			*score = 1;
+		return res;
+	}
 
-	int res = 0;
-	float maxm = 0;
-	for (int h = 1; h <= height; ++h)
+	if (m_pyramid_levels > 0)
 	{
-		float avgm = calcAvgMatch(top, down, height - h);
-		if (avgm >= maxm)
+		float pyramid_score = 0;
+		res = PyramidMatch::match(top, down, m_pyramid_levels, &pyramid_score);
+
+		// summed rows of heavily changed content hardly ever match, scan then
+		if (pyramid_score >= 0.5f)
 		{
-			maxm = avgm;
-			res = max(res, h);
+			if (score)
+				*score = pyramid_score;
+			return res;
 		}
 	}
 
-	return res;
+	const int height = min(top.height(), down.height());
+	if (height <= 0)
+	{
+		if (score)
+			*score = 0;
+		return 0;
+	}
+
+	// every h is scored, the best key wins whatever order the workers finish in.
+	// a candidate is only dropped once it is below a key already seen, so the
+	// result is the largest h of the highest score, as a sequential scan gives
+	ThreadPool* pool = m_match_pool ? m_match_pool : m_pool;
+	atomic<uint64_t> best(0);
+	const int chunks = pool ? min(height, 4 * (pool->size() + 1)) : 1;
+	auto scan = [&](int chunk)
+	{
+		// interleaved so every chunk gets long and short overlaps alike,
+		// the long ones first as they win ties
+		for (int h = height - chunk; h >= 1; h -= chunks)
+		{
+			float avgm = calcAvgMatch(top, down, h, best);
+			if (avgm >= 0)
+				raiseBound(best, candidateKey(avgm, h));
+		}
+	};
+	if (chunks > 1)
+		pool->parallelFor(chunks, scan);
+	else
+		scan(0);
+
+	const uint64_t key = best.load();
+	const uint32_t bits = uint32_t(key >> 32);
+	if (score)
+		memcpy(score, &bits, sizeof(bits));
+	return int(key & 0xffffffff);
+}
+
+void ImageMatchMerge::logStats()
+{
+	if (!m_stats_log.empty())
+		m_stats.writeJsonLines(m_stats_log, m_image_files.empty() ? "" : m_image_files[0]);
 }
 
 bool ImageMatchMerge::run()
 {
-	
-	clock_t begin = clock(), end = 0;
-	float elapsed_time = 0;
+	m_stats.reset();
+	const double wall = StageTimer::wallMs(), cpu = StageTimer::cpuMs();
 
-	const int num = m_image_files.size();
+	int num = m_image_files.size();
 
 	if (num <= 0)
 		return false;
 
 	vector<Halide::Image<uint8_t> > input(num);
-	vector<Halide::Image<uint32_t> > sums(num);
+	vector<RowFingerprint> sums(num), sums20(num);
 
-	// load all image 
-	for (int i = 0; i < num; ++i)
+	unique_ptr<ThreadPool> local_pool(m_pool ? NULL : new ThreadPool(m_decode_threads));
+	ThreadPool& pool = m_pool ? *m_pool : *local_pool;
+	m_match_pool = &pool;
+
+	// load all image, decoded in parallel and handed over in order
 	{
-		input[i] = load_image(m_image_files[i]);
+		StageTimer t(m_stats, "load");
+		// head and tail come from the 10 pixel keys of every frame
+		FrameDecoder decoder(m_image_files, pool, m_max_decoded, &buffers(), num, m_signature_cache);
+		FrameDecoder::Keys keys;
+		for (int i = 0; i < num; ++i)
+		{
+			input[i] = decoder.next(&keys);
+			if (!keys.empty())
+			{
+				swap(sums[i], keys.sums);
+				swap(sums20[i], keys.sums20);
+			}
+			t.m_bytes += imageBytes(input[i]) + keyBytes(sums[i]) + keyBytes(sums20[i]);
+		}
+		t.m_pool_misses = (int)decoder.poolMisses();
 	}
 
-	printf("channels %d\n", input[0].channels());
+	// sum image block, the only pass over the pixels for all block widths.
+	// PNG frames got their keys while decoding
+	{
+		StageTimer t(m_stats, "signature");
+		for (int i = 0; i < num; ++i)
+		{
+			if (sums[i].height() > 0)
+				continue;
 
-	end = clock();
-	elapsed_time = float(end - begin) / CLOCKS_PER_SEC;
-	printf("load time = %f\n", elapsed_time);
-	begin = clock();
+			//sums[i] = sumImageRow(input[i]);
+			t.m_bytes += buildSignatures(input[i], sums[i], sums20[i]);
+		}
+	}
 
-	// sum image block 
-	for (int i = 0; i < num; ++i)
+	// a frame equal to the one before adds no rows, drop it before any matching.
+	// a run of equal frames would also leave no rows between head and tail
 	{
-		//sums[i] = sumImageRow(input[i]);
-		sums[i] = sumImageRowBlock(input[i], 10);
+		StageTimer t(m_stats, "dedup");
+		int kept = 1;
+		uint64_t prev = sums20[0].frameHash();
+		t.m_bytes = sizeof(uint64_t) * sums20[0].m_rows.size();
+		for (int i = 1; i < num; ++i)
+		{
+			const uint64_t hash = sums20[i].frameHash();
+			t.m_bytes += sizeof(uint64_t) * sums20[i].m_rows.size();
+			if (hash == prev && RowFingerprint::frameEqual(sums20[i], sums20[kept - 1]))
+			{
+				buffers().release(input[i]);
+				continue;
+			}
+			prev = hash;
+			input[kept] = input[i];
+			swap(sums[kept], sums[i]);
+			swap(sums20[kept], sums20[i]);
+			++kept;
+		}
+		m_stats.m_duplicates = num - kept;
+		num = kept;
+		input.resize(num);
+		sums.resize(num);
+		sums20.resize(num);
 	}
 
-	end = clock();
-	elapsed_time = float(end - begin) / CLOCKS_PER_SEC;
-	printf("sum image block time = %f\n", elapsed_time);
-	begin = clock();
-
 	const int width = input[0].width(), height = input[0].height(), channel = input[0].channels();
 
-	int head = height, tail = height;
-	for (int i = 0; i < num - 1; ++i)
+	// sticky header and footer common to all frames, static columns in between
+	int head = 0, tail = 0;
+	vector<uint8_t> static_columns;
+	if (num > 1)
 	{
-		auto ht = findHeadAndTail2(sums[0], sums[1]);
+		StageTimer t(m_stats, "findHeadAndTail");
+		auto ht = StaticRegions::findHeadAndTail(sums);
+		head = max(0, get<0>(ht));
+		tail = max(0, get<1>(ht));
+		static_columns = StaticRegions::staticColumns(sums20, head, tail);
+		for (int i = 0; i < num; ++i)
+		{
+			t.m_bytes += keyBytes(sums[i]) + keyBytes(sums20[i]);
+		}
+	}
+	const bool skip_columns = find(static_columns.begin(), static_columns.end(), 1) != static_columns.end();
 
-		head = min(head, get<0>(ht));
-		tail = min(tail, get<1>(ht));
+	assert(tail + head < height);
+
+	// cut head and tail. frames that differ from the one before only in the
+	// sticky bars or static columns (a stalled scroll) are dropped here
+	vector<ImageView<uint8_t> > cuts(num);
+	vector<RowFingerprint> cut_sums(num);
+	{
+		StageTimer t(m_stats, "cut");
+		int kept = 0;
+		uint64_t prev = 0;
+		for (int i = 0; i < num; ++i)
+		{
+			cuts[kept] = cutHeadAndTail<uint8_t>(input[i], head, tail);
+			//cut_sums[i] = cutHeadAndTail(sums[i], head, tail);
+			cut_sums[kept] = sums20[i].crop(head, tail);
+			t.m_bytes += 2 * keyBytes(cut_sums[kept]);
+			if (skip_columns)
+			{
+				t.m_bytes += keyBytes(cut_sums[kept]);
+				cut_sums[kept] = cut_sums[kept].selectColumns(static_columns);
+				t.m_bytes += keyBytes(cut_sums[kept]);
+			}
+
+			//sprintf_s(filename, "out%d.png", i);
+			//save_image(cuts[i], filename);
+
+			const uint64_t hash = cut_sums[kept].frameHash();
+			t.m_bytes += sizeof(uint64_t) * cut_sums[kept].m_rows.size();
+			if (kept > 0 && hash == prev && RowFingerprint::frameEqual(cut_sums[kept], cut_sums[kept - 1]))
+				continue;
+			prev = hash;
+			++kept;
+		}
+		m_stats.m_duplicates += num - kept;
+		cuts.resize(kept);
+		cut_sums.resize(kept);
 	}
+	const int kept = cuts.size();
 
-	printf("head = %d, tail = %d\n", head, tail);
+	// find match bwtween cuts
+	vector<int> match(kept, 0);
+	{
+		StageTimer t(m_stats, "match");
+		for (int i = 0; i < kept - 1; ++i)
+		{
+			//match[i] = avgMatchImages(cuts[i], cuts[i + 1]);
+			float score = 0;
+			match[i] = avgMatchImages(cut_sums[i], cut_sums[i + 1], &score);
+			m_stats.addPair(i, match[i], score);
+			t.m_bytes += keyBytes(cut_sums[i]) + keyBytes(cut_sums[i + 1]);
+		}
+	}
+	m_match_pool = NULL;
 
-	assert(tail + head < height);
+	// joint all the cut images
+	{
+		StageTimer t(m_stats, "joint");
+		Compositor joint;
 
-	end = clock();
-	elapsed_time = float(end - begin) / CLOCKS_PER_SEC;
-	printf("findHeadAndTail time = %f\n", elapsed_time);
-	begin = clock();
+		//header
+		joint.add(ImageView<uint8_t>(input[0]).crop(0, head), 0);
 
-	// cut head and tail
-	vector<Halide::Image<uint8_t> > cuts(num);
-	vector<Halide::Image<uint32_t> > cut_sums(num);
+		//image
+		int curh = head;
+		for (int i = 0; i < kept; ++i)
+		{
+			int imgh = cuts[i].height() - match[i];
+			joint.add(cuts[i].crop(0, imgh), curh);
+			curh += imgh;
+		}
+
+		//tail
+		joint.add(ImageView<uint8_t>(input[0]).crop(height - tail, tail), curh);
+
+		m_result = Halide::Image<uint8_t>(width, curh + tail, channel);
+		joint.blit(m_result, pool);
+		t.m_bytes = 2 * imageBytes(m_result);
+	}
+
+	// the next run of the same capture size decodes into these
 	for (int i = 0; i < num; ++i)
 	{
-		cuts[i] = cutHeadAndTail(input[i], head, tail);
-		//cut_sums[i] = cutHeadAndTail(sums[i], head, tail);
-		cut_sums[i] = sumImageRowBlock(cuts[i], 20);
-
-		//sprintf_s(filename, "out%d.png", i);
-		//save_image(cuts[i], filename);
+		buffers().release(input[i]);
 	}
 
-	end = clock();
-	elapsed_time = float(end - begin) / CLOCKS_PER_SEC;
-	printf("cutHeadAndTail time = %f\n", elapsed_time);
-	begin = clock();
+	m_stats.m_frames = kept;
+	m_stats.m_width = width;
+	m_stats.m_height = height;
+	m_stats.m_head = head;
+	m_stats.m_tail = tail;
+	m_stats.m_result_height = m_result.height();
+	m_stats.m_wall_ms = StageTimer::wallMs() - wall;
+	m_stats.m_cpu_ms = StageTimer::cpuMs() - cpu;
+	logStats();
 
-	// find match bwtween cuts
-	vector<int> match(num, 0);
-	int matchall = 0;
-	for (int i = 0; i < num - 1; ++i)
+	return true;
+}
+
+bool ImageMatchMerge::runPipelined()
+{
+	m_stats.reset();
+	const double wall = StageTimer::wallMs(), cpu = StageTimer::cpuMs();
+
+	const int num = m_image_files.size();
+
+	if (num <= 0)
+		return false;
+
+	if (num == 1)
 	{
-		//match[i] = avgMatchImages(cuts[i], cuts[i + 1]);
-		match[i] = avgMatchImages(cut_sums[i], cut_sums[i + 1]);
-		matchall += match[i];
-		cout << "match = " << match[i] << endl;
+		m_result = load_image(m_image_files[0]);
+		return true;
 	}
 
-	end = clock();
-	elapsed_time = float(end - begin) / CLOCKS_PER_SEC;
-	printf("avgMatchImages time = %f\n", elapsed_time);
-	begin = clock();
+	vector<Halide::Image<uint8_t> > input(num);
+	vector<RowFingerprint> sums(2), sums20(2), cut_sums(num);
+	vector<int> match(num, 0);
+	vector<char> duplicate(num, 0);
+	int head = 0, tail = 0, cut_height = 0;
 
-	// joint all the cut images
-	Func joint("joint");
-	Var x("x"), y("y"), c("c");
-	joint(x, y, c) = cast<uint8_t>(0);
+	// rows of a channel are contiguous, the plane stride is fixed by the upper
+	// bound of the result height so every segment can be placed before the
+	// later matches are known
+	Halide::Image<uint8_t> storage;
+
+	// decoding frame i waits for the blit that frees frame i - in_flight, so at
+	// most in_flight frames are held besides frame 0. matching frame i - 1 needs
+	// frame i, two is the least that can work
+	const int in_flight = max(2, m_max_decoded);
+
+	// decode time keys. the signature of frame i hands their storage on to
+	// frame i + in_flight, decoded after it
+	vector<FrameDecoder::Keys> keys(num);
+
+	// set by find_head, frames decoded after it key the rows between head and tail only
+	atomic<bool> cut_known(false);
+
+	// frames find_head decoded ahead of their task, their keys are not handed on to
+	vector<char> preloaded(num, 0);
+	unique_ptr<once_flag[]> decoded(new once_flag[num]);
+
+	// task bodies, for frame i
+
+	// frame i is decoded once, by its task or by find_head, whichever comes first
+	auto load_frame = [&](int i, int key_head, int key_tail)
+	{
+		call_once(decoded[i], [&]
+		{
+			StageTimer t(m_stats, "decode", true);
+			input[i] = FrameDecoder::load(m_image_files[i], &buffers(), keys[i], key_head, key_tail, m_signature_cache);
+			t.m_bytes = imageBytes(input[i]) + keyBytes(keys[i].sums) + keyBytes(keys[i].sums20);
+		});
+	};
+
+	auto decode = [&](int i)
+	{
+		int key_head = -1, key_tail = 0;
+		if (i >= 2)
+		{
+			const bool cut = cut_known.load(memory_order_acquire);
+			key_head = cut ? head : 0;
+			key_tail = cut ? tail : 0;
+		}
+		load_frame(i, key_head, key_tail);
+	};
+
+	// the first pair is keyed in full to find head and tail
+	auto full_signature = [&](int i)
+	{
+		StageTimer t(m_stats, "signature", true);
+		FrameDecoder::Keys& k = keys[i];
+		if (!k.empty())
+		{
+			swap(sums[i], k.sums);
+			swap(sums20[i], k.sums20);
+			return;
+		}
+		t.m_bytes = buildSignatures(input[i], sums[i], sums20[i]);
+	};
+
+	auto find_head = [&]
+	{
+		StageTimer t(m_stats, "findHeadAndTail", true);
+		const int height = input[0].height();
+
+		// the second frame repeats the first: head and tail come from the first
+		// frame that differs. frames up to it are decoded here when their task
+		// has not run yet, and stay held until their blit, past in_flight too
+		RowFingerprint other, other20;
+		const RowFingerprint* second = &sums[1];
+		bool differs = !RowFingerprint::frameEqual(sums20[1], sums20[0]);
+		for (int j = 2; j < num && !differs; ++j)
+		{
+			load_frame(j, -1, 0);
+			preloaded[j] = 1;
+			const FrameDecoder::Keys& k = keys[j];
+			const RowFingerprint* second20 = &k.sums20;
+			second = &k.sums;
+			if (k.sums.height() == 0)
+			{
+				t.m_bytes += buildSignatures(input[j], other, other20);
+				second = &other;
+				second20 = &other20;
+			}
+			differs = !RowFingerprint::frameEqual(*second20, sums20[0]);
+		}
+
+		// all frames equal, nothing is sticky
+		if (differs)
+		{
+			auto ht = findHeadAndTail2(sums[0], *second);
+			head = max(0, get<0>(ht));
+			tail = max(0, get<1>(ht));
+		}
+		assert(tail + head < height);
+
+		cut_height = height - head - tail;
+		storage = Halide::Image<uint8_t>(input[0].width(), head + num * cut_height + tail, input[0].channels());
+		Compositor::copyRows(ImageView<uint8_t>(storage).crop(0, head), ImageView<uint8_t>(input[0]).crop(0, head));
+		sums20[0].crop(head, tail, cut_sums[0]);
+		sums20[1].crop(head, tail, cut_sums[1]);
+		t.m_bytes += keyBytes(sums[0]) + keyBytes(*second) + 2 * imageBytes(ImageView<uint8_t>(input[0]).crop(0, head)) + 
+			2 * keyBytes(cut_sums[0]) + 2 * keyBytes(cut_sums[1]);
+		cut_known.store(true, memory_order_release);
+	};
+
+	// later frames only key the rows between head and tail
+	auto cut_signature = [&](int i)
+	{
+		StageTimer t(m_stats, "signature", true);
+		FrameDecoder::Keys& k = keys[i];
+		if (!k.empty())
+			t.m_bytes = takeCut(k, head, tail, cut_sums[i]);
+		else
+			t.m_bytes = buildCutSignature(input[i], head, tail, cut_sums[i]);
+		if (i + in_flight < num && !preloaded[i + in_flight])
+			swap(keys[i + in_flight], k);
+	};
+
+	auto match_pair = [&](int i)
+	{
+		StageTimer t(m_stats, "match", true);
+
+		// frame i + 1 repeats frame i between head and tail: overlapping in
+		// full, frame i adds no rows, as if it was dropped
+		if (RowFingerprint::frameEqual(cut_sums[i], cut_sums[i + 1]))
+		{
+			match[i] = cut_height;
+			duplicate[i] = 1;
+			return;
+		}
+		float score = 0;
+		match[i] = avgMatchImages(cut_sums[i], cut_sums[i + 1], &score);
+		m_stats.addPair(i, match[i], score);
+		t.m_bytes = keyBytes(cut_sums[i]) + keyBytes(cut_sums[i + 1]);
+	};
+
+	auto blit = [&](int i)
+	{
+		StageTimer t(m_stats, "blit", true);
+		int y = head;
+		for (int j = 0; j < i; ++j)
+		{
+			y += cut_height - match[j];
+		}
+		const int rows = cut_height - match[i];
+		Compositor::copyRows(ImageView<uint8_t>(storage).crop(y, rows), ImageView<uint8_t>(input[i]).crop(head, rows));
+		t.m_bytes = 2 * imageBytes(ImageView<uint8_t>(input[i]).crop(head, rows));
+
+		// frame 0 still provides the footer
+		if (i > 0)
+			buffers().release(input[i]);
+	};
+
+	TaskGraph graph;
+	vector<TaskGraph::TaskId> decode_task(num), sig_task(num), match_task(num - 1), blit_task(num);
+	TaskGraph::TaskId head_task = -1;
 
-	const int res_width = width;
-	const int res_height = height * 3 - (head + tail) * 2 - matchall;
+	// segment i lands right after segments 0..i-1, so it waits for their matches only
+	auto add_blit = [&](int i)
+	{
+		vector<TaskGraph::TaskId> deps(match_task.begin(), match_task.begin() + min(i + 1, num - 1));
+		deps.push_back(sig_task[i]);
+		blit_task[i] = graph.add([&, i] { blit(i); }, deps);
+	};
+
+	// added frame by frame, every dependency exists when it is named
+	for (int i = 0; i < num; ++i)
+	{
+		vector<TaskGraph::TaskId> deps;
+		if (i >= in_flight)
+			deps.push_back(blit_task[i - in_flight]);
+		decode_task[i] = graph.add([&, i] { decode(i); }, deps);
 
-	//header
-	RDom headr(0, head);
-	joint(x, headr, c) = input[0](x, headr, c);
+		if (i < 2)
+			sig_task[i] = graph.add([&, i] { full_signature(i); }, { decode_task[i] });
+		else
+			sig_task[i] = graph.add([&, i] { cut_signature(i); }, { decode_task[i], head_task });
 
-	//image
-	int curh = head;
+		if (i == 1)
+			head_task = graph.add(find_head, { sig_task[0], sig_task[1] });
+
+		if (i > 0)
+		{
+			match_task[i - 1] = graph.add([&, i] { match_pair(i - 1); }, 
+				{ head_task, sig_task[i - 1], sig_task[i] });
+			add_blit(i - 1);
+		}
+	}
+	add_blit(num - 1);
+
+	graph.run();
+
+	int res_height = head + tail;
 	for (int i = 0; i < num; ++i)
 	{
-		int imgh = cuts[0].height() - match[i];
-		RDom imgr(0, imgh);
-		joint(x, curh + imgr, c) = cuts[i](x, imgr, c);
-		curh += imgh;
+		res_height += cut_height - match[i];
 	}
+	Compositor::copyRows(ImageView<uint8_t>(storage).crop(res_height - tail, tail), 
+		ImageView<uint8_t>(input[0]).crop(input[0].height() - tail, tail));
+
+	// m_result views the first res_height rows of every plane of storage
+	buffer_t buf = *storage.raw_buffer();
+	buf.extent[1] = res_height;
+	m_result = Halide::Image<uint8_t>(Halide::Buffer(Halide::UInt(8), &buf, "result"));
+	m_result_storage = storage;
+
+	// pairs finish in any order
+	sort(m_stats.m_pairs.begin(), m_stats.m_pairs.end(), 
+		[](const PairStats& a, const PairStats& b) { return a.frame < b.frame; });
+	m_stats.m_duplicates = (int)count(duplicate.begin(), duplicate.end(), 1);
+	m_stats.m_frames = num - m_stats.m_duplicates;
+	m_stats.m_width = input[0].width();
+	m_stats.m_height = input[0].height();
+	m_stats.m_head = head;
+	m_stats.m_tail = tail;
+	m_stats.m_result_height = res_height;
+	m_stats.m_wall_ms = StageTimer::wallMs() - wall;
+	m_stats.m_cpu_ms = StageTimer::cpuMs() - cpu;
+	logStats();
 
-	//tail
-	RDom tailr(0, tail);
-	joint(x, res_height - tail - 1 + tailr, c) = input[0](x, height - tail - 1 + tailr, c);
+	return true;
+}
 
-	m_result = joint.realize(res_width, res_height, channel);
+bool ImageMatchMerge::runStreaming(RowSink* sink)
+{
+	if (m_image_files.empty())
+		return false;
 
-	end = clock();
-	elapsed_time = float(end - begin) / CLOCKS_PER_SEC;
-	printf("joint time = %f\n", elapsed_time);
-	begin = clock();
+	unique_ptr<ThreadPool> local_pool(m_pool ? NULL : new ThreadPool(m_decode_threads));
+	ThreadPool& pool = m_pool ? *m_pool : *local_pool;
+	FrameDecoder decoder(m_image_files, pool, m_max_decoded, &buffers(), 2, m_signature_cache);
+
+	begin(sink);
+	m_match_pool = &pool;
+	Halide::Image<uint8_t> prev;
+	FrameDecoder::Keys keys;
+	bool cut = false;
+	size_t pool_misses = 0;
+	while (!decoder.done())
+	{
+		Halide::Image<uint8_t> frame;
+		{
+			// frames are allocated on the decode threads, the last wait has seen them all
+			StageTimer t(m_stats, "decode_wait");
+			frame = decoder.next(&keys);
+			t.m_pool_misses = int(decoder.poolMisses() - pool_misses);
+			pool_misses += t.m_pool_misses;
+		}
+		append(frame, &keys);
+
+		// head and tail are known, later frames key the rows between them only
+		if (!cut && m_frames >= 2)
+		{
+			decoder.setCut(m_head, m_tail);
+			cut = true;
+		}
+
+		// append() has let go of the frame before and the sink copied what it
+		// kept of it (RowSink::writeRows), decode into it again
+		buffers().release(prev);
+		prev = frame;
+	}
+	finish();
+	buffers().release(prev);
+	m_match_pool = NULL;
 
 	return true;
 }
 
-void ImageMatchMerge::saveResult(const std::string& filename)
+void ImageMatchMerge::begin(RowSink* sink)
+{
+	m_result_sink.reset();
+	m_sink = sink ? sink : &m_result_sink;
+	m_frames = 0;
+	m_head = m_tail = 0;
+	m_prev_hash = 0;
+	m_prev = m_footer = Halide::Image<uint8_t>();
+	m_stats.reset();
+	m_stream_wall = StageTimer::wallMs();
+	m_stream_cpu = StageTimer::cpuMs();
+}
+
+void ImageMatchMerge::append(const Halide::Image<uint8_t>& frame, FrameDecoder::Keys* keys)
+{
+	if (!m_sink)
+		begin();
+
+	// frames of one capture share their shape: after the first two the pool
+	// and the reused fingerprints serve every buffer without allocating.
+	// once head and tail are known only the rows between them are keyed
+	StageTimer sig(m_stats, "signature");
+	if (keys && !keys->empty() && m_frames >= 2)
+		sig.m_bytes = takeCut(*keys, m_head, m_tail, m_cut_sums);
+	else if (keys && keys->sums.height() > 0)
+	{
+		swap(m_sums, keys->sums);
+		swap(m_sums20, keys->sums20);
+	}
+	else if (m_frames < 2)
+		sig.m_bytes = buildSignatures(frame, m_sums, m_sums20);
+	else
+		sig.m_bytes = buildCutSignature(frame, m_head, m_tail, m_cut_sums);
+	sig.stop();
+
+	// a frame equal to the previous one, in full before head and tail are
+	// known and between them after, takes its place without adding rows
+	const uint64_t hash = m_frames < 2 ? m_sums20.frameHash() : m_cut_sums.frameHash();
+	if (m_frames > 0 && hash == m_prev_hash && (m_frames < 2 ? RowFingerprint::frameEqual(m_sums20, m_prev_sums20) : 
+		RowFingerprint::frameEqual(m_cut_sums, m_prev_cut_sums)))
+	{
+		m_prev = frame;
+		if (m_frames < 2)
+		{
+			swap(m_prev_sums, m_sums);
+			swap(m_prev_sums20, m_sums20);
+		}
+		else
+			swap(m_prev_cut_sums, m_cut_sums);
+		m_stats.m_duplicates++;
+		return;
+	}
+	m_prev_hash = hash;
+
+	if (m_frames == 0)
+	{
+		m_prev = frame;
+		swap(m_prev_sums, m_sums);
+		swap(m_prev_sums20, m_sums20);
+		++m_frames;
+		return;
+	}
+
+	assert(frame.width() == m_prev.width() && frame.height() == m_prev.height());
+	const int height = frame.height();
+
+	if (m_frames == 1)
+	{
+		// head and tail from the first pair, as run() does
+		StageTimer t(m_stats, "findHeadAndTail");
+		auto ht = findHeadAndTail2(m_prev_sums, m_sums);
+		m_head = max(0, get<0>(ht));
+		m_tail = max(0, get<1>(ht));
+		assert(m_tail + m_head < height);
+		t.m_bytes = keyBytes(m_prev_sums) + keyBytes(m_sums);
+		t.stop();
+
+		m_sink->writeRows(ImageView<uint8_t>(m_prev).crop(0, m_head));
+		m_stats.m_result_height += m_head;
+		if (m_tail > 0)
+			m_footer = ImageView<uint8_t>(m_prev).crop(height - m_tail, m_tail).copy();
+
+		m_prev_sums20.crop(m_head, m_tail, m_prev_cut_sums);
+		m_sums20.crop(m_head, m_tail, m_cut_sums);
+		m_prev_hash = m_cut_sums.frameHash();
+	}
+
+	// rows of the previous frame above the overlap are final now
+	const int cut_height = height - m_head - m_tail;
+	StageTimer t(m_stats, "match");
+	float score = 0;
+	int match = avgMatchImages(m_prev_cut_sums, m_cut_sums, &score);
+	m_stats.addPair(m_frames - 1, match, score);
+	t.m_bytes = keyBytes(m_prev_cut_sums) + keyBytes(m_cut_sums);
+	t.stop();
+
+	StageTimer w(m_stats, "write");
+	m_sink->writeRows(ImageView<uint8_t>(m_prev).crop(m_head, cut_height - match));
+	w.m_bytes = imageBytes(ImageView<uint8_t>(m_prev).crop(m_head, cut_height - match));
+	w.stop();
+	m_stats.m_result_height += cut_height - match;
+
+	m_prev = frame;
+	swap(m_prev_cut_sums, m_cut_sums);
+	++m_frames;
+}
+
+void ImageMatchMerge::finish()
 {
+	if (!m_sink)
+		return;
+
+	StageTimer w(m_stats, "write");
+	if (m_frames == 1)
+	{
+		m_sink->writeRows(m_prev);
+		m_stats.m_result_height += m_prev.height();
+	}
+	else if (m_frames > 1)
+	{
+		m_sink->writeRows(cutHeadAndTail<uint8_t>(m_prev, m_head, m_tail));
+		if (m_tail > 0)
+			m_sink->writeRows(m_footer);
+		m_stats.m_result_height += m_prev.height() - m_head;
+	}
+	m_sink->finish();
+	w.m_bytes = m_frames > 0 ? imageBytes(m_prev) : 0;
+	w.stop();
+
+	m_stats.m_frames = m_frames;
+	m_stats.m_width = m_prev.width();
+	m_stats.m_height = m_prev.height();
+	m_stats.m_head = m_head;
+	m_stats.m_tail = m_tail;
+	m_stats.m_wall_ms = StageTimer::wallMs() - m_stream_wall;
+	m_stats.m_cpu_ms = StageTimer::cpuMs() - m_stream_cpu;
+	logStats();
+
+	if (m_sink == &m_result_sink)
+	{
+		m_result = m_result_sink.m_result;
+		m_result_sink.reset();
+	}
+
+	m_sink = NULL;
+	m_frames = 0;
+	m_prev = m_footer = Halide::Image<uint8_t>();
+}
+
+bool ImageMatchMerge::saveResult(const std::string& filename)
+{
+	if (!m_result.defined())
+		return false;
+
+	// save_image reports nothing, an old file must not pass for the new one
+	remove(filename.c_str());
 	save_image(m_result, filename);
+
+	FILE* file = fopen(filename.c_str(), "rb");
+	if (!file)
+		return false;
+	const bool ok = fseek(file, 0, SEEK_END) == 0 && ftell(file) > 0;
+	fclose(file);
+	return ok;
 }
\ No newline at end of file
@@ -10,36 +10,136 @@
 #include <tuple>
 #include <string.h>
 #include "Halide.h"
+#include "RowFingerprint.h"
+#include "ImageView.h"
+#include "RowSink.h"
+#include "ThreadPool.h"
+#include "BufferPool.h"
+#include "SignatureCache.h"
+#include "FrameDecoder.h"
+#include "MergeStats.h"
 
 class ImageMatchMerge
 {
 public:
-	ImageMatchMerge() {}
+	ImageMatchMerge() 
+		: m_pool(NULL), m_buffers(NULL), m_signature_cache(NULL), m_decode_threads(0), m_max_decoded(8), m_pyramid_levels(0),
+		m_match_pool(NULL), m_sink(NULL), m_frames(0), m_head(0), m_tail(0), m_prev_hash(0),
+		m_stream_wall(0), m_stream_cpu(0)
+	{
+	}
 
 	ImageMatchMerge(const std::vector<std::string>& image_files) 
+		: ImageMatchMerge()
 	{
 		m_image_files = image_files;
 	}
 
 	bool run();
 
-	void saveResult(const std::string& filename);
+	// same result as run(), as one task graph: decode, signatures, matching and
+	// copying into m_result overlap instead of running phase by phase
+	bool runPipelined();
+
+	// decode m_image_files in parallel and feed them through append/finish
+	bool runStreaming(RowSink* sink = NULL);
+
+	// streaming: append frames in capture order, finalized rows go to sink
+	// as soon as they are known, NULL sink collects them into m_result.
+	// only the previous frame is kept, memory does not grow with the capture
+	void begin(RowSink* sink = NULL);
+
+	// keys: built while decoding, taken over when they cover what the frame
+	// needs (their storage is exchanged, not freed), NULL builds them here
+	void append(const Halide::Image<uint8_t>& frame, FrameDecoder::Keys* keys = NULL);
+
+	void finish();
+
+	// false when there is no result or the file was not written
+	bool saveResult(const std::string& filename);
 
 	std::vector<std::string> m_image_files;
 
+	// workers for decoding, NULL runs a private pool of m_decode_threads (0 = all cores)
+	ThreadPool* m_pool;
+
+	// prefix and block sum images recycled across frames and runs, NULL uses
+	// a private pool. share one between mergers of same sized frames
+	BufferPool* m_buffers;
+
+	// keys of frames seen by earlier runs are read from here, new ones added.
+	// NULL computes the keys of every frame
+	SignatureCache* m_signature_cache;
+
+	int m_decode_threads;
+
+	// frames decoded ahead of the matcher at most
+	int m_max_decoded;
+
+	// levels of the coarse to fine overlap search when there is no exact
+	// overlap. faster, but it may settle on another offset than the full
+	// scan; 0 (default) scans every offset at full resolution
+	int m_pyramid_levels;
+
 	Halide::Image<uint8_t> m_result;
 
+	// timing and match scores of the last run, reset by every run and begin()
+	MergeStats m_stats;
+
+	// when set, m_stats is appended here as JSON lines after every run
+	std::string m_stats_log;
+
 private:
-	Halide::Image<uint32_t> sumImageRow(const Halide::Image<uint8_t>& input);
+	// times the private stages one by one
+	friend class StageBenchmark;
 
-	Halide::Image<uint32_t> sumImageRowBlock(const Halide::Image<uint8_t>& input, int block_width);
+	Halide::Image<uint32_t> sumImageRow(const Halide::Image<uint8_t>& input);
 
-	std::tuple<int, int> findHeadAndTail(const Halide::Image<uint32_t>& sum1, 
-		const Halide::Image<uint32_t>& sum2);
+	std::tuple<int, int> findHeadAndTail(const RowFingerprint& sum1, 
+		const RowFingerprint& sum2);
 
 	template<typename T>
-	Halide::Image<T> cutHeadAndTail(const Halide::Image<T>& input, int headLen, int tailLen);
+	ImageView<T> cutHeadAndTail(const ImageView<T>& input, int headLen, int tailLen);
 
-	template<typename T>
-	int avgMatchImages(const Halide::Image<T>& top, const Halide::Image<T>& down);
-};
\ No newline at end of file
+	// block keys 10 and 20 pixels wide, the prefix and block sums come from buffers().
+	// returns the bytes of the buffers read and written
+	uint64_t buildSignatures(const Halide::Image<uint8_t>& frame, RowFingerprint& sums, RowFingerprint& sums20);
+
+	// 20 pixel keys of rows [head, height - tail) only, one pass over those
+	// rows, same keys as cropping the full frame ones
+	uint64_t buildCutSignature(const Halide::Image<uint8_t>& frame, int head, int tail, RowFingerprint& cut_sums20);
+
+	BufferPool& buffers() { return m_buffers ? *m_buffers : m_own_buffers; }
+
+	// score: fraction of equal blocks over the chosen overlap
+	int avgMatchImages(const RowFingerprint& top, const RowFingerprint& down, float* score = NULL);
+
+	void logStats();
+
+	// pool of the running run()/runStreaming(), splits the full overlap scan of
+	// avgMatchImages. NULL falls back to m_pool, then to the calling thread
+	ThreadPool* m_match_pool;
+
+	BufferPool m_own_buffers;
+
+	// backing store of m_result when it is narrower than the allocation
+	Halide::Image<uint8_t> m_result_storage;
+
+	// streaming state
+	RowSink* m_sink;
+	ImageRowSink m_result_sink;
+	int m_frames, m_head, m_tail;
+
+	// frameHash of the last frame kept, its cut rows once head and tail are known
+	uint64_t m_prev_hash;
+	Halide::Image<uint8_t> m_prev, m_footer;
+	RowFingerprint m_prev_sums, m_prev_sums20;
+
+	// reused every frame, their storage only grows on the first ones.
+	// full frame keys serve the first pair, cut keys every match
+	RowFingerprint m_sums, m_sums20, m_prev_cut_sums, m_cut_sums;
+	double m_stream_wall, m_stream_cpu;
+};
+
+// rows at the top and the bottom that two frames share (sticky header and footer)
+std::tuple<int, int> findHeadAndTail2(const RowFingerprint& sum1, const RowFingerprint& sum2);
\ No newline at end of file
@@ -0,0 +1,103 @@
+/************************************************************************/
+/* ImageView:
+	non-owning window on the pixels of a Halide image, base pointer plus
+	strides and extents. cropping is O(1) and never allocates, the viewed
+	image must outlive the view
+*/
+/************************************************************************/
+
+#pragma once
+#include <string.h>
+#include <assert.h>
+#include <algorithm>
+#include "Halide.h"
+
+template<typename T>
+class ImageView
+{
+public:
+	ImageView() : m_data(NULL)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			m_extent[i] = m_stride[i] = 0;
+		}
+	}
+
+	ImageView(const Halide::Image<T>& image) : m_data(image.data())
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			m_extent[i] = image.extent(i);
+			m_stride[i] = image.stride(i);
+		}
+	}
+
+	// rows [y, y + rows)
+	ImageView crop(int y, int rows) const
+	{
+		assert(y >= 0 && rows >= 0 && y + rows <= height());
+		ImageView res(*this);
+		res.m_data = m_data + y * m_stride[1];
+		res.m_extent[1] = rows;
+		return res;
+	}
+
+	int width() const { return m_extent[0]; }
+
+	int height() const { return m_extent[1]; }
+
+	int channels() const { return m_extent[2]; }
+
+	int stride(int d) const { return m_stride[d]; }
+
+	T* data() const { return m_data; }
+
+	bool defined() const { return m_data != NULL; }
+
+	T& operator()(int x, int y, int c = 0) const
+	{
+		return m_data[x * m_stride[0] + y * m_stride[1] + c * m_stride[2]];
+	}
+
+	// Halide image aliasing the same pixels, to feed a pipeline
+	Halide::Image<T> image() const
+	{
+		buffer_t buf;
+		memset(&buf, 0, sizeof(buf));
+		buf.host = (uint8_t*)m_data;
+		buf.elem_size = sizeof(T);
+		for (int i = 0; i < 3; ++i)
+		{
+			buf.extent[i] = m_extent[i];
+			buf.stride[i] = m_stride[i];
+		}
+		return Halide::Image<T>(Halide::Buffer(Halide::type_of<T>(), &buf));
+	}
+
+	// dense image owning a copy of the pixels
+	Halide::Image<T> copy() const
+	{
+		Halide::Image<T> res(width(), height(), channels());
+		for (int c = 0; c < std::max(1, channels()); ++c)
+		{
+			for (int y = 0; y < height(); ++y)
+			{
+				if (m_stride[0] == 1)
+				{
+					memcpy(&res(0, y, c), &(*this)(0, y, c), sizeof(T) * width());
+					continue;
+				}
+				for (int x = 0; x < width(); ++x)
+				{
+					res(x, y, c) = (*this)(x, y, c);
+				}
+			}
+		}
+		return res;
+	}
+
+private:
+	T* m_data;
+	int m_extent[3], m_stride[3];
+};
@@ -0,0 +1,161 @@
+/************************************************************************/
+/* MergeStats:
+	per stage wall clock and CPU time, bytes touched and BufferPool misses
+	of one ImageMatchMerge run, plus the score of every matched pair.
+	printable, or appended to a file as JSON lines
+*/
+/************************************************************************/
+
+#include "stdafx.h"
+#include "MergeStats.h"
+#include "BufferPool.h"
+#include <chrono>
+#define NOMINMAX
+#include <windows.h>
+
+using namespace std;
+
+void MergeStats::reset()
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_stages.clear();
+	m_pairs.clear();
+	m_frames = m_width = m_height = m_head = m_tail = m_result_height = m_duplicates = 0;
+	m_wall_ms = m_cpu_ms = 0;
+}
+
+void MergeStats::addStage(const std::string& name, double wall_ms, double cpu_ms, uint64_t bytes, int pool_misses)
+{
+	lock_guard<mutex> lock(m_mutex);
+	StageStats* s = NULL;
+	for (size_t i = 0; i < m_stages.size() && !s; ++i)
+	{
+		if (m_stages[i].name == name)
+			s = &m_stages[i];
+	}
+	if (!s)
+	{
+		StageStats empty = { name, 0, 0, 0, 0, 0 };
+		m_stages.push_back(empty);
+		s = &m_stages.back();
+	}
+
+	s->calls++;
+	s->wall_ms += wall_ms;
+	s->cpu_ms += cpu_ms;
+	s->bytes += bytes;
+	s->pool_misses += pool_misses;
+}
+
+void MergeStats::addPair(int frame, int offset, float score)
+{
+	lock_guard<mutex> lock(m_mutex);
+	PairStats p = { frame, offset, score };
+	m_pairs.push_back(p);
+}
+
+const StageStats* MergeStats::stage(const std::string& name) const
+{
+	for (size_t i = 0; i < m_stages.size(); ++i)
+	{
+		if (m_stages[i].name == name)
+			return &m_stages[i];
+	}
+	return NULL;
+}
+
+void MergeStats::print(FILE* file) const
+{
+	fprintf(file, "%d frames %dx%d, head = %d, tail = %d, result height = %d, %d duplicates dropped\n", 
+		m_frames, m_width, m_height, m_head, m_tail, m_result_height, m_duplicates);
+	for (size_t i = 0; i < m_pairs.size(); ++i)
+	{
+		fprintf(file, "match %d = %d (%f)\n", m_pairs[i].frame, m_pairs[i].offset, m_pairs[i].score);
+	}
+	for (size_t i = 0; i < m_stages.size(); ++i)
+	{
+		const StageStats& s = m_stages[i];
+		fprintf(file, "%-16s wall %9.3f ms  cpu %9.3f ms  %10llu bytes  %d pool misses\n", 
+			s.name.c_str(), s.wall_ms, s.cpu_ms, (unsigned long long)s.bytes, s.pool_misses);
+	}
+	fprintf(file, "total            wall %9.3f ms  cpu %9.3f ms\n", m_wall_ms, m_cpu_ms);
+}
+
+bool MergeStats::writeJsonLines(const std::string& filename, const std::string& job) const
+{
+	// batch jobs share one log
+	static mutex log_mutex;
+	lock_guard<mutex> lock(log_mutex);
+
+	FILE* file = fopen(filename.c_str(), "a");
+	if (!file)
+		return false;
+
+	string tag;
+	for (size_t i = 0; i < job.size(); ++i)
+	{
+		if (job[i] == '"' || job[i] == '\\')
+			tag += '\\';
+		tag += job[i];
+	}
+
+	for (size_t i = 0; i < m_stages.size(); ++i)
+	{
+		const StageStats& s = m_stages[i];
+		fprintf(file, "{\"job\": \"%s\", \"type\": \"stage\", \"name\": \"%s\", \"calls\": %d, "
+			"\"wall_ms\": %.4f, \"cpu_ms\": %.4f, \"bytes\": %llu, \"pool_misses\": %d}\n",
+			tag.c_str(), s.name.c_str(), s.calls, s.wall_ms, s.cpu_ms, (unsigned long long)s.bytes, s.pool_misses);
+	}
+	for (size_t i = 0; i < m_pairs.size(); ++i)
+	{
+		fprintf(file, "{\"job\": \"%s\", \"type\": \"pair\", \"frame\": %d, \"offset\": %d, \"score\": %.6f}\n",
+			tag.c_str(), m_pairs[i].frame, m_pairs[i].offset, m_pairs[i].score);
+	}
+	fprintf(file, "{\"job\": \"%s\", \"type\": \"run\", \"frames\": %d, \"width\": %d, \"height\": %d, "
+		"\"head\": %d, \"tail\": %d, \"result_height\": %d, \"duplicates\": %d, \"wall_ms\": %.4f, \"cpu_ms\": %.4f}\n",
+		tag.c_str(), m_frames, m_width, m_height, m_head, m_tail, m_result_height, m_duplicates, m_wall_ms, m_cpu_ms);
+
+	const bool ok = ferror(file) == 0;
+	fclose(file);
+	return ok;
+}
+
+StageTimer::StageTimer(MergeStats& stats, const char* name, bool per_thread)
+	: m_bytes(0), m_pool_misses(0), m_stats(stats), m_name(name), 
+	m_per_thread(per_thread), m_running(true)
+{
+	m_wall = wallMs();
+	m_cpu = cpuMs(per_thread);
+	m_thread_misses = BufferPool::threadMisses();
+}
+
+void StageTimer::stop()
+{
+	if (!m_running)
+		return;
+	m_running = false;
+	m_pool_misses += int(BufferPool::threadMisses() - m_thread_misses);
+	m_stats.addStage(m_name, wallMs() - m_wall, cpuMs(m_per_thread) - m_cpu, m_bytes, m_pool_misses);
+}
+
+double StageTimer::wallMs()
+{
+	return chrono::duration<double, milli>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+double StageTimer::cpuMs(bool per_thread)
+{
+	FILETIME creation, exit, kernel, user;
+	BOOL ok = per_thread ? GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)
+		: GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+	if (!ok)
+		return 0;
+
+	// 100 ns units
+	ULARGE_INTEGER k, u;
+	k.LowPart = kernel.dwLowDateTime;
+	k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;
+	u.HighPart = user.dwHighDateTime;
+	return (k.QuadPart + u.QuadPart) / 1e4;
+}
@@ -0,0 +1,96 @@
+/************************************************************************/
+/* MergeStats:
+	per stage wall clock and CPU time, bytes touched and BufferPool misses
+	of one ImageMatchMerge run, plus the score of every matched pair.
+	printable, or appended to a file as JSON lines
+*/
+/************************************************************************/
+
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <mutex>
+
+struct StageStats
+{
+	std::string name;
+	int calls;
+	double wall_ms, cpu_ms;
+	uint64_t bytes;		// sizes of the pixel and key buffers read and written, once per pass
+	// BufferPool images allocated because no free one fitted. other heap
+	// allocations (the result, key vectors, crops) are not counted
+	int pool_misses;
+};
+
+struct PairStats
+{
+	int frame;		// frames frame and frame + 1
+	int offset;		// overlapping rows
+	float score;	// fraction of equal blocks over the overlap, 1 = exact
+};
+
+class MergeStats
+{
+public:
+	MergeStats() { reset(); }
+
+	void reset();
+
+	// accumulates into the stage of that name, thread safe
+	void addStage(const std::string& name, double wall_ms, double cpu_ms, uint64_t bytes, int pool_misses);
+
+	void addPair(int frame, int offset, float score);
+
+	// NULL if the stage did not run
+	const StageStats* stage(const std::string& name) const;
+
+	void print(FILE* file) const;
+
+	// append one line per stage and pair and a summary line, all tagged with job
+	bool writeJsonLines(const std::string& filename, const std::string& job) const;
+
+	std::vector<StageStats> m_stages;
+	std::vector<PairStats> m_pairs;
+	int m_frames, m_width, m_height, m_head, m_tail, m_result_height;
+	double m_wall_ms, m_cpu_ms;
+
+	// consecutive duplicate frames dropped before matching, not in m_frames
+	int m_duplicates;
+
+private:
+	std::mutex m_mutex;
+};
+
+// times a stage from construction to stop() or destruction
+class StageTimer
+{
+public:
+	// per_thread counts the CPU time of the calling thread only, for stages
+	// running next to others (tasks of runPipelined)
+	StageTimer(MergeStats& stats, const char* name, bool per_thread = false);
+
+	~StageTimer() { stop(); }
+
+	void stop();
+
+	// monotonic wall clock
+	static double wallMs();
+
+	// CPU time of the process, or of the calling thread
+	static double cpuMs(bool per_thread = false);
+
+	uint64_t m_bytes;
+
+	// BufferPool misses of the calling thread are added on stop(),
+	// set this for those on other threads
+	int m_pool_misses;
+
+private:
+	MergeStats& m_stats;
+	const char* m_name;
+	bool m_per_thread, m_running;
+	double m_wall, m_cpu;
+	size_t m_thread_misses;
+};
@@ -0,0 +1,80 @@
+/************************************************************************/
+/* OverlapSearch:
+	find the overlap between the bottom of one image and the top of the
+	next one in O(H*W), by hashing every row and running a KMP longest
+	suffix/prefix match over the row hashes
+*/
+/************************************************************************/
+
+#include "stdafx.h"
+#include "OverlapSearch.h"
+
+using namespace std;
+
+std::vector<int> OverlapSearch::suffixPrefixMatches(const std::vector<uint64_t>& top,
+	const std::vector<uint64_t>& down)
+{
+	const int m = (int)down.size();
+	vector<int> res;
+	if (m == 0 || top.empty())
+		return res;
+
+	// failure function of down
+	vector<int> fail(m, 0);
+	for (int i = 1, k = 0; i < m; ++i)
+	{
+		while (k > 0 && down[i] != down[k])
+			k = fail[k - 1];
+		if (down[i] == down[k])
+			++k;
+		fail[i] = k;
+	}
+
+	// run down over top, q ends as the longest suffix of top that is a prefix of down
+	int q = 0;
+	for (size_t i = 0; i < top.size(); ++i)
+	{
+		if (q == m)
+			q = fail[q - 1];
+		while (q > 0 && top[i] != down[q])
+			q = fail[q - 1];
+		if (top[i] == down[q])
+			++q;
+	}
+
+	// every shorter border of that match is a match too
+	for (; q > 0; q = fail[q - 1])
+	{
+		res.push_back(q);
+	}
+	return res;
+}
+
+int OverlapSearch::findExactOverlap(const RowFingerprint& top, const RowFingerprint& down,
+	TieBreak tie)
+{
+	// row hashes only compare across equal widths
+	if (top.height() > down.height() || top.width() != down.width())
+		return 0;
+
+	vector<int> candidates = suffixPrefixMatches(top.m_rows, down.m_rows);
+
+	int res = 0;
+	for (size_t i = 0; i < candidates.size(); ++i)
+	{
+		const int h = candidates[i];
+		bool equal = true;
+		for (int y = 0; y < h && equal; ++y)
+		{
+			equal = RowFingerprint::rowEqual(top, top.height() - h + y, down, y);
+		}
+
+		if (equal)
+		{
+			res = h;
+			if (tie == LargestOverlap)
+				break;
+		}
+	}
+	return res;
+}
@@ -0,0 +1,31 @@
+/************************************************************************/
+/* OverlapSearch:
+	find the overlap between the bottom of one image and the top of the
+	next one in O(H*W), by hashing every row and running a KMP longest
+	suffix/prefix match over the row hashes
+*/
+/************************************************************************/
+
+#pragma once
+#include <vector>
+#include <stdint.h>
+#include "RowFingerprint.h"
+
+class OverlapSearch
+{
+public:
+	enum TieBreak
+	{
+		LargestOverlap,		// same rule as avgMatchImages: largest h with the max score
+		SmallestOverlap
+	};
+
+	// all h, largest first, where the last h keys of top equal the first h keys of down
+	static std::vector<int> suffixPrefixMatches(const std::vector<uint64_t>& top,
+		const std::vector<uint64_t>& down);
+
+	// overlap h where the last h rows of top equal the first h rows of down,
+	// rows equal when all block keys equal. 0 if there is none
+	static int findExactOverlap(const RowFingerprint& top, const RowFingerprint& down,
+		TieBreak tie = LargestOverlap);
+};
@@ -0,0 +1,42 @@
+/************************************************************************/
+/* PipelineCache:
+	process wide cache of JIT compiled pipelines for builds without
+	HALIDE_AOT. a pipeline is compiled once per (name, element type,
+	channel count), later calls only rebind its ImageParam and Params
+*/
+/************************************************************************/
+
+#include "stdafx.h"
+#include "PipelineCache.h"
+
+using namespace std;
+
+PipelineCache& PipelineCache::instance()
+{
+	static PipelineCache cache;
+	return cache;
+}
+
+PipelineCache::Pipeline& PipelineCache::get(const std::string& name, Halide::Type type, 
+	int channels, const Builder& build)
+{
+	char key[256];
+	sprintf_s(key, "%s/%d.%d/%d", name.c_str(), (int)type.code, type.bits, channels);
+
+	lock_guard<mutex> lock(m_mutex);
+	unique_ptr<Pipeline>& entry = m_pipelines[key];
+	if (!entry)
+	{
+		entry.reset(new Pipeline);
+		entry->input = Halide::ImageParam(type, 3, name + "_input");
+		entry->func = build(*entry);
+		entry->func.compile_jit();
+	}
+	return *entry;
+}
+
+int PipelineCache::size()
+{
+	lock_guard<mutex> lock(m_mutex);
+	return (int)m_pipelines.size();
+}
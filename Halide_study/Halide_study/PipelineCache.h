@@ -0,0 +1,46 @@
+/************************************************************************/
+/* PipelineCache:
+	process wide cache of JIT compiled pipelines for builds without
+	HALIDE_AOT. a pipeline is compiled once per (name, element type,
+	channel count), later calls only rebind its ImageParam and Params
+*/
+/************************************************************************/
+
+#pragma once
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <functional>
+#include "Halide.h"
+
+class PipelineCache
+{
+public:
+	struct Pipeline
+	{
+		Halide::ImageParam input;
+		Halide::Param<int> arg[2];
+		Halide::Func func;
+
+		// the params are shared state, lock around set + realize
+		std::mutex mutex;
+	};
+
+	// defines func of a new entry from its input and args
+	typedef std::function<Halide::Func(Pipeline&)> Builder;
+
+	static PipelineCache& instance();
+
+	// the cached pipeline, built and compiled on first use
+	Pipeline& get(const std::string& name, Halide::Type type, int channels, const Builder& build);
+
+	// pipelines compiled so far
+	int size();
+
+private:
+	PipelineCache() {}
+
+	std::mutex m_mutex;
+	std::map<std::string, std::unique_ptr<Pipeline> > m_pipelines;
+};
@@ -0,0 +1,272 @@
+/************************************************************************/
+/* PngRowSink:
+	encode rows to a PNG file as they arrive, the full image is never
+	held in memory. deflate runs on its own thread so encoding overlaps
+	with whatever produces the rows
+*/
+/************************************************************************/
+
+#include "stdafx.h"
+#include "PngRowSink.h"
+
+using namespace std;
+
+static const size_t kIdatSize = 256 << 10;
+
+// IHDR data starts right after the signature and the chunk length and type
+static const long kIhdrOffset = 8 + 8;
+
+static void putBE32(uint8_t* p, uint32_t v)
+{
+	p[0] = uint8_t(v >> 24);
+	p[1] = uint8_t(v >> 16);
+	p[2] = uint8_t(v >> 8);
+	p[3] = uint8_t(v);
+}
+
+static uint8_t paeth(int a, int b, int c)
+{
+	const int p = a + b - c;
+	const int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	if (pa <= pb && pa <= pc)
+		return uint8_t(a);
+	return uint8_t(pb <= pc ? b : c);
+}
+
+PngRowSink::PngRowSink(const std::string& filename, int level, int strategy, 
+	Filter filter, size_t max_queued_bytes)
+	: m_file(fopen(filename.c_str(), "wb")), m_level(level), m_strategy(strategy), 
+	m_filter(filter), m_max_queued_bytes(max_queued_bytes), 
+	m_ok(true), m_started(false), m_finished(false),
+	m_width(0), m_channels(0), m_height(0), m_queued_bytes(0), m_closing(false)
+{
+	if (!m_file)
+	{
+		printf("can not open %s for writing\n", filename.c_str());
+		m_ok = false;
+	}
+}
+
+PngRowSink::~PngRowSink()
+{
+	finish();
+}
+
+void PngRowSink::start(int width, int channels)
+{
+	static const uint8_t color_type[5] = { 0, 0, 4, 2, 6 };
+	static const uint8_t signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+
+	assert(channels >= 1 && channels <= 4);
+	m_width = width;
+	m_channels = channels;
+	m_started = true;
+
+	// the height is not known yet, finish() patches it in
+	memset(m_ihdr, 0, sizeof(m_ihdr));
+	putBE32(m_ihdr, width);
+	m_ihdr[8] = 8;
+	m_ihdr[9] = color_type[channels];
+
+	if (fwrite(signature, 1, sizeof(signature), m_file) != sizeof(signature))
+		m_ok = false;
+	writeChunk("IHDR", m_ihdr, sizeof(m_ihdr));
+
+	memset(&m_zstream, 0, sizeof(m_zstream));
+	if (deflateInit2(&m_zstream, m_level, Z_DEFLATED, 15, 8, m_strategy) != Z_OK)
+		m_ok = false;
+
+	const size_t row_bytes = size_t(width) * channels;
+	m_out.resize(kIdatSize);
+	m_zstream.next_out = &m_out[0];
+	m_zstream.avail_out = (uInt)kIdatSize;
+	m_filtered.resize(row_bytes + 1);
+	m_prev_row.assign(row_bytes, 0);
+
+	m_thread = thread(&PngRowSink::encode, this);
+}
+
+void PngRowSink::writeRows(const ImageView<uint8_t>& src)
+{
+	if (!m_ok || m_finished || src.height() == 0)
+		return;
+
+	if (!m_started)
+		start(src.width(), max(1, src.channels()));
+	assert(src.width() == m_width && max(1, src.channels()) == m_channels);
+
+	// interleave here, the source rows may be gone before the encoder gets to them
+	Block block;
+	block.rows = src.height();
+	block.data.resize(size_t(m_width) * m_channels * block.rows);
+	uint8_t* out = &block.data[0];
+	for (int y = 0; y < block.rows; ++y)
+	{
+		for (int c = 0; c < m_channels; ++c)
+		{
+			const uint8_t* row = &src(0, y, c);
+			for (int x = 0; x < m_width; ++x)
+			{
+				out[x * m_channels + c] = row[x * src.stride(0)];
+			}
+		}
+		out += size_t(m_width) * m_channels;
+	}
+	m_height += block.rows;
+
+	unique_lock<mutex> lock(m_mutex);
+	m_cond.wait(lock, [this] { return m_queued_bytes < m_max_queued_bytes; });
+	m_queued_bytes += block.data.size();
+	m_queue.push_back(move(block));
+	m_cond.notify_all();
+}
+
+void PngRowSink::finish()
+{
+	if (m_finished)
+		return;
+	m_finished = true;
+
+	if (m_started)
+	{
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_closing = true;
+		}
+		m_cond.notify_all();
+		m_thread.join();
+
+		deflateBuffer(NULL, 0, Z_FINISH);
+		deflateEnd(&m_zstream);
+		writeChunk("IEND", NULL, 0);
+
+		// patch the height and the crc of IHDR
+		putBE32(m_ihdr + 4, m_height);
+		uLong crc = crc32(crc32(0, NULL, 0), (const Bytef*)"IHDR", 4);
+		crc = crc32(crc, m_ihdr, sizeof(m_ihdr));
+		uint8_t crc_bytes[4];
+		putBE32(crc_bytes, (uint32_t)crc);
+		if (fseek(m_file, kIhdrOffset, SEEK_SET) != 0 ||
+			fwrite(m_ihdr, 1, sizeof(m_ihdr), m_file) != sizeof(m_ihdr) ||
+			fwrite(crc_bytes, 1, 4, m_file) != 4)
+			m_ok = false;
+	}
+
+	if (m_file)
+	{
+		if (fclose(m_file) != 0)
+			m_ok = false;
+		m_file = NULL;
+	}
+}
+
+void PngRowSink::encode()
+{
+	const size_t row_bytes = size_t(m_width) * m_channels;
+	for (;;)
+	{
+		Block block;
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_cond.wait(lock, [this] { return m_closing || !m_queue.empty(); });
+			if (m_queue.empty())
+				return;
+
+			block = move(m_queue.front());
+			m_queue.pop_front();
+			m_queued_bytes -= block.data.size();
+		}
+		m_cond.notify_all();
+
+		for (int y = 0; y < block.rows; ++y)
+		{
+			const uint8_t* row = &block.data[y * row_bytes];
+			deflateRow(row, &m_prev_row[0]);
+			memcpy(&m_prev_row[0], row, row_bytes);
+		}
+	}
+}
+
+void PngRowSink::deflateRow(const uint8_t* row, const uint8_t* prev)
+{
+	const int bpp = m_channels;
+	const int n = m_width * m_channels;
+	uint8_t* out = &m_filtered[1];
+	m_filtered[0] = uint8_t(m_filter);
+
+	switch (m_filter)
+	{
+	case FilterSub:
+		for (int i = 0; i < n; ++i)
+		{
+			out[i] = uint8_t(row[i] - (i >= bpp ? row[i - bpp] : 0));
+		}
+		break;
+	case FilterUp:
+		for (int i = 0; i < n; ++i)
+		{
+			out[i] = uint8_t(row[i] - prev[i]);
+		}
+		break;
+	case FilterPaeth:
+		for (int i = 0; i < n; ++i)
+		{
+			const int a = i >= bpp ? row[i - bpp] : 0, c = i >= bpp ? prev[i - bpp] : 0;
+			out[i] = uint8_t(row[i] - paeth(a, prev[i], c));
+		}
+		break;
+	default:
+		memcpy(out, row, n);
+		break;
+	}
+
+	deflateBuffer(&m_filtered[0], n + 1, Z_NO_FLUSH);
+}
+
+void PngRowSink::deflateBuffer(const uint8_t* data, size_t size, int flush)
+{
+	m_zstream.next_in = const_cast<Bytef*>(data);
+	m_zstream.avail_in = (uInt)size;
+	for (;;)
+	{
+		const int ret = deflate(&m_zstream, flush);
+		if (ret == Z_STREAM_ERROR)
+		{
+			m_ok = false;
+			return;
+		}
+
+		// a full output buffer becomes one IDAT chunk
+		if (m_zstream.avail_out == 0 || ret == Z_STREAM_END)
+		{
+			writeChunk("IDAT", &m_out[0], (uint32_t)(kIdatSize - m_zstream.avail_out));
+			m_zstream.next_out = &m_out[0];
+			m_zstream.avail_out = (uInt)kIdatSize;
+		}
+
+		if (ret == Z_STREAM_END || (flush != Z_FINISH && m_zstream.avail_in == 0))
+			return;
+	}
+}
+
+void PngRowSink::writeChunk(const char* type, const uint8_t* data, uint32_t size)
+{
+	if (!m_file)
+		return;
+
+	uint8_t head[8];
+	putBE32(head, size);
+	memcpy(head + 4, type, 4);
+
+	uLong crc = crc32(0, NULL, 0);
+	crc = crc32(crc, head + 4, 4);
+	if (size > 0)
+		crc = crc32(crc, data, size);
+	uint8_t tail[4];
+	putBE32(tail, (uint32_t)crc);
+
+	if (fwrite(head, 1, 8, m_file) != 8 ||
+		(size > 0 && fwrite(data, 1, size, m_file) != size) ||
+		fwrite(tail, 1, 4, m_file) != 4)
+		m_ok = false;
+}
@@ -0,0 +1,86 @@
+/************************************************************************/
+/* PngRowSink:
+	encode rows to a PNG file as they arrive, the full image is never
+	held in memory. deflate runs on its own thread so encoding overlaps
+	with whatever produces the rows
+*/
+/************************************************************************/
+
+#pragma once
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include "zlib.h"
+#include "RowSink.h"
+
+class PngRowSink : public RowSink
+{
+public:
+	// PNG row filter applied to every row
+	enum Filter
+	{
+		FilterNone = 0,
+		FilterSub = 1,
+		FilterUp = 2,
+		FilterPaeth = 4
+	};
+
+	// level and strategy are passed to deflateInit2 (Z_RLE suits screenshots well).
+	// max_queued_bytes bounds the rows waiting for the encoder
+	PngRowSink(const std::string& filename, int level = Z_DEFAULT_COMPRESSION, 
+		int strategy = Z_DEFAULT_STRATEGY, Filter filter = FilterUp, 
+		size_t max_queued_bytes = 64 << 20);
+
+	virtual ~PngRowSink();
+
+	virtual void writeRows(const ImageView<uint8_t>& src);
+
+	// flush, then write the final height into the header
+	virtual void finish();
+
+	// false after any I/O or zlib error
+	bool ok() const { return m_ok; }
+
+private:
+	struct Block
+	{
+		std::vector<uint8_t> data;	// interleaved rows
+		int rows;
+	};
+
+	void start(int width, int channels);
+
+	void encode();
+
+	void deflateRow(const uint8_t* row, const uint8_t* prev);
+
+	void deflateBuffer(const uint8_t* data, size_t size, int flush);
+
+	void writeChunk(const char* type, const uint8_t* data, uint32_t size);
+
+	FILE* m_file;
+	int m_level, m_strategy;
+	Filter m_filter;
+	const size_t m_max_queued_bytes;
+	std::atomic<bool> m_ok;
+	bool m_started, m_finished;
+	int m_width, m_channels;
+	uint32_t m_height;
+	uint8_t m_ihdr[13];
+
+	// owned by the encoder thread
+	z_stream m_zstream;
+	std::vector<uint8_t> m_out, m_filtered, m_prev_row;
+
+	std::thread m_thread;
+	std::deque<Block> m_queue;
+	size_t m_queued_bytes;
+	bool m_closing;
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+};
@@ -0,0 +1,82 @@
+/************************************************************************/
+/* PngRowSource:
+	decode a PNG file one row at a time with libpng, every row is handed
+	to a callback while it is still in cache. 8 bit RGB and RGBA without
+	interlacing only, anything else is left to load_image
+*/
+/************************************************************************/
+
+#include "stdafx.h"
+#include "PngRowSource.h"
+
+using namespace std;
+
+PngRowSource::PngRowSource(const std::string& filename, std::vector<uint8_t>* row_buffer)
+	: m_file(fopen(filename.c_str(), "rb")), m_png(NULL), m_info(NULL), m_ok(false),
+	m_width(0), m_height(0), m_channels(0), m_next_row(0), m_row(row_buffer ? *row_buffer : m_own_row)
+{
+	if (!m_file)
+		return;
+
+	png_byte header[8];
+	if (fread(header, 1, sizeof(header), m_file) != sizeof(header) || png_sig_cmp(header, 0, sizeof(header)))
+		return;
+
+	m_png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	if (!m_png)
+		return;
+	m_info = png_create_info_struct(m_png);
+	if (!m_info)
+		return;
+
+	// libpng reports errors by longjmp, nothing here needs unwinding
+	if (setjmp(png_jmpbuf(m_png)))
+		return;
+
+	png_init_io(m_png, m_file);
+	png_set_sig_bytes(m_png, sizeof(header));
+	png_read_info(m_png, m_info);
+
+	const int color_type = png_get_color_type(m_png, m_info);
+	if (png_get_bit_depth(m_png, m_info) != 8 || png_get_interlace_type(m_png, m_info) != PNG_INTERLACE_NONE ||
+		(color_type != PNG_COLOR_TYPE_RGB && color_type != PNG_COLOR_TYPE_RGB_ALPHA))
+		return;
+
+	m_width = png_get_image_width(m_png, m_info);
+	m_height = png_get_image_height(m_png, m_info);
+	m_channels = png_get_channels(m_png, m_info);
+	m_row.resize(png_get_rowbytes(m_png, m_info));
+	m_ok = true;
+}
+
+PngRowSource::~PngRowSource()
+{
+	if (m_png)
+		png_destroy_read_struct(&m_png, m_info ? &m_info : NULL, NULL);
+	if (m_file)
+		fclose(m_file);
+}
+
+bool PngRowSource::read(const std::function<void(int, const uint8_t*)>& fn, int rows)
+{
+	if (rows < 0 || rows > m_height)
+		rows = m_height;
+
+	for (; m_ok && m_next_row < rows; ++m_next_row)
+	{
+		if (!readRow())
+			m_ok = false;
+		else
+			fn(m_next_row, m_row.data());
+	}
+	return m_ok;
+}
+
+bool PngRowSource::readRow()
+{
+	if (setjmp(png_jmpbuf(m_png)))
+		return false;
+
+	png_read_row(m_png, m_row.data(), NULL);
+	return true;
+}
@@ -0,0 +1,49 @@
+/************************************************************************/
+/* PngRowSource:
+	decode a PNG file one row at a time with libpng, every row is handed
+	to a callback while it is still in cache. 8 bit RGB and RGBA without
+	interlacing only, anything else is left to load_image
+*/
+/************************************************************************/
+
+#pragma once
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <functional>
+#include "png.h"
+
+class PngRowSource
+{
+public:
+	// row_buffer: row storage to reuse across files, may be NULL
+	explicit PngRowSource(const std::string& filename, std::vector<uint8_t>* row_buffer = NULL);
+
+	~PngRowSource();
+
+	// false when the file is missing, in an unsupported format or fails to decode
+	bool ok() const { return m_ok; }
+
+	int width() const { return m_width; }
+
+	int height() const { return m_height; }
+
+	int channels() const { return m_channels; }
+
+	// decode rows 0 .. rows - 1 (all when rows < 0) in order, fn(y, pixels) gets
+	// the interleaved pixels of row y, valid during the call only. rows can be
+	// read once, stopping early leaves the rest of the file untouched
+	bool read(const std::function<void(int, const uint8_t*)>& fn, int rows = -1);
+
+private:
+	// one png_read_row into m_row, false on a libpng error
+	bool readRow();
+
+	FILE* m_file;
+	png_structp m_png;
+	png_infop m_info;
+	bool m_ok;
+	int m_width, m_height, m_channels, m_next_row;
+	std::vector<uint8_t> m_own_row;
+	std::vector<uint8_t>& m_row;
+};
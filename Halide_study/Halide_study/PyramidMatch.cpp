@@ -0,0 +1,170 @@
+/************************************************************************/
+/* PyramidMatch:
+	coarse to fine version of the avgMatchImages scan. every overlap h is
+	scored on rows summed 2^levels at a time, the best candidates are
+	rescored within a small window at each finer level and the last level
+	is the full resolution score, so an offset the coarse levels keep
+	comes out exactly as the full scan would pick it
+*/
+/************************************************************************/
+
+#include "stdafx.h"
+#include "PyramidMatch.h"
+#include <algorithm>
+
+using namespace std;
+
+// candidates carried from one level to the next
+static const size_t kCandidates = 8;
+
+int PyramidMatch::match(const RowFingerprint& top, const RowFingerprint& down, int levels, float* score_out)
+{
+	const int width = min(top.width(), down.width());
+	const int top_height = top.height(), down_height = down.height();
+	const int height = min(top_height, down_height);
+	if (height <= 0 || width <= 0)
+		return 0;
+	levels = min(levels, SIGNATURE_PYRAMID_LEVELS);
+
+	// level 0 reads the fingerprints, level l sums pairs of level l - 1 rows
+	vector<Level> pyramid(levels + 1);
+	pyramid[0].factor = 1;
+	pyramid[0].top = top.blocks(0);
+	pyramid[0].down = down.blocks(0);
+	pyramid[0].top_stride = top.width();
+	pyramid[0].down_stride = down.width();
+	for (int l = 1; l <= levels; ++l)
+	{
+		const Level& prev = pyramid[l - 1];
+		Level& cur = pyramid[l];
+		cur.factor = prev.factor * 2;
+		cur.top_stride = cur.down_stride = width;
+
+		const int top_rows = max(0, top_height - cur.factor + 1);
+		cur.top_storage.resize(size_t(top_rows) * width);
+		for (int y = 0; y < top_rows; ++y)
+		{
+			const RowFingerprint::Key* a = prev.top + size_t(y) * prev.top_stride;
+			const RowFingerprint::Key* b = prev.top + size_t(y + prev.factor) * prev.top_stride;
+			RowFingerprint::Key* out = &cur.top_storage[size_t(y) * width];
+			for (int x = 0; x < width; ++x)
+			{
+				out[x] = a[x] + b[x];
+			}
+		}
+
+		const int down_rows = down_height / cur.factor;
+		cur.down_storage.resize(size_t(down_rows) * width);
+		for (int k = 0; k < down_rows; ++k)
+		{
+			const RowFingerprint::Key* a = prev.down + size_t(2 * k) * prev.down_stride;
+			const RowFingerprint::Key* b = prev.down + size_t(2 * k + 1) * prev.down_stride;
+			RowFingerprint::Key* out = &cur.down_storage[size_t(k) * width];
+			for (int x = 0; x < width; ++x)
+			{
+				out[x] = a[x] + b[x];
+			}
+		}
+
+		cur.top = cur.top_storage.data();
+		cur.down = cur.down_storage.data();
+	}
+
+	// every h at the coarsest level
+	vector<int> hs;
+	vector<float> scores;
+	for (int h = 1; h <= height; ++h)
+	{
+		hs.push_back(h);
+		scores.push_back(score(pyramid[levels], width, top_height, down_height, h));
+	}
+	vector<int> candidates = best(hs, scores, kCandidates);
+
+	for (int l = levels - 1; l >= 0; --l)
+	{
+		// h shorter than a group at a coarser level is scored from here on
+		const int radius = pyramid[l].factor * 2;
+		vector<char> seen(height + 1, 0);
+		hs.clear();
+		scores.clear();
+		for (int h = 1; h < min(pyramid[l + 1].factor, height + 1); ++h)
+		{
+			seen[h] = 1;
+			hs.push_back(h);
+		}
+		for (size_t i = 0; i < candidates.size(); ++i)
+		{
+			for (int h = max(1, candidates[i] - radius); h <= min(height, candidates[i] + radius); ++h)
+			{
+				if (!seen[h])
+				{
+					seen[h] = 1;
+					hs.push_back(h);
+				}
+			}
+		}
+		for (size_t i = 0; i < hs.size(); ++i)
+		{
+			scores.push_back(score(pyramid[l], width, top_height, down_height, hs[i]));
+		}
+		if (l == 0)
+		{
+			candidates = best(hs, scores, 1);
+			break;
+		}
+
+		// a partial group can sink a good offset at one level only, keep what
+		// the coarser levels found next to the best of this one
+		vector<int> next = best(hs, scores, kCandidates);
+		for (size_t i = 0; i < candidates.size(); ++i)
+		{
+			if (find(next.begin(), next.end(), candidates[i]) == next.end())
+				next.push_back(candidates[i]);
+		}
+		candidates.swap(next);
+	}
+
+	if (score_out)
+		*score_out = score(pyramid[0], width, top_height, down_height, candidates[0]);
+	return candidates[0];
+}
+
+float PyramidMatch::score(const Level& level, int width, int top_height, int down_height, int h)
+{
+	// rows as the full scan compares them: from top row height - h on
+	const int offset = min(top_height, down_height) - h;
+	const int rows = min(top_height - offset, down_height);
+	const int groups = rows / level.factor;
+	if (groups <= 0)
+		return -1;
+
+	int match = 0;
+	for (int k = 0; k < groups; ++k)
+	{
+		match += RowFingerprint::countEqual(level.top + size_t(offset + k * level.factor) * level.top_stride, 
+			level.down + size_t(k) * level.down_stride, width);
+	}
+	return float(match) / (groups * width);
+}
+
+std::vector<int> PyramidMatch::best(const std::vector<int>& hs, const std::vector<float>& scores, size_t count)
+{
+	vector<size_t> order(hs.size());
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		order[i] = i;
+	}
+
+	count = min(count, order.size());
+	partial_sort(order.begin(), order.begin() + count, order.end(), [&](size_t a, size_t b)
+	{
+		return scores[a] != scores[b] ? scores[a] > scores[b] : hs[a] > hs[b];
+	});
+
+	vector<int> res(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		res[i] = hs[order[i]];
+	}
+	return res;
+}
@@ -0,0 +1,41 @@
+/************************************************************************/
+/* PyramidMatch:
+	coarse to fine version of the avgMatchImages scan. every overlap h is
+	scored on rows summed 2^levels at a time, the best candidates are
+	rescored within a small window at each finer level and the last level
+	is the full resolution score. approximate: an offset the coarse levels
+	drop is never rescored, so the result can differ from the full scan
+*/
+/************************************************************************/
+
+#pragma once
+#include <vector>
+#include <stdint.h>
+#include "RowFingerprint.h"
+
+class PyramidMatch
+{
+public:
+	// largest h with the best score among the candidates the coarse levels keep.
+	// block keys are summed lane by lane, levels is capped at the
+	// SIGNATURE_PYRAMID_LEVELS the key lanes have room for
+	static int match(const RowFingerprint& top, const RowFingerprint& down, int levels = 4, 
+		float* score = NULL);
+
+private:
+	struct Level
+	{
+		int factor;
+		const RowFingerprint::Key* top;	// row y: sum of top rows y .. y + factor - 1
+		const RowFingerprint::Key* down;	// row k: sum of down rows k * factor .. (k + 1) * factor - 1
+		int top_stride, down_stride;
+		std::vector<RowFingerprint::Key> top_storage, down_storage;
+	};
+
+	// fraction of equal block sums over the overlap h, -1 if it is shorter than one group
+	static float score(const Level& level, int width, int top_height, int down_height, int h);
+
+	// best count candidates, higher score first, larger h first on ties
+	static std::vector<int> best(const std::vector<int>& hs, const std::vector<float>& scores, 
+		size_t count);
+};
@@ -0,0 +1,382 @@
+/************************************************************************/
+/* RowFingerprint:
+	compact per-row and per-block keys of a block sum image, built once
+	at load time and shared by head/tail detection and overlap search
+*/
+/************************************************************************/
+
+#include "stdafx.h"
+#include "RowFingerprint.h"
+#if defined(_M_IX86) || defined(_M_X64)
+#include <intrin.h>
+#endif
+
+using namespace std;
+
+void RowFingerprint::build(const Halide::Image<BlockSum>& sums)
+{
+	const int kChannels = SIGNATURE_CHANNELS;
+	m_width = sums.width();
+	m_height = sums.height();
+	const int channels = min(sums.channels(), kChannels);
+	const BlockSum* data = sums.data();
+
+	m_blocks.resize(size_t(m_width) * m_height);
+	m_rows.resize(m_height);
+
+	for (int y = 0; y < m_height; ++y)
+	{
+		const BlockSum* c[kChannels];
+		for (int k = 0; k < kChannels; ++k)
+		{
+			c[k] = data + y * sums.stride(1) + min(k, channels - 1) * sums.stride(2);
+		}
+
+		Key* out = &m_blocks[size_t(y) * m_width];
+		for (int b = 0; b < m_width; ++b)
+		{
+			uint32_t lane[kChannels];
+			for (int k = 0; k < kChannels; ++k)
+			{
+				lane[k] = c[k][b];
+			}
+			out[b] = FingerprintSignature::pack(lane);
+		}
+		m_rows[y] = hashKeys(out, m_width);
+	}
+}
+
+void RowFingerprint::resize(int width, int height)
+{
+	m_width = width;
+	m_height = height;
+	m_blocks.resize(size_t(m_width) * m_height);
+	m_rows.resize(m_height);
+}
+
+void RowFingerprint::clear()
+{
+	m_width = m_height = 0;
+	m_blocks.clear();
+	m_rows.clear();
+}
+
+void RowFingerprint::setRow(int y, const uint32_t* sums, int channels)
+{
+	const int kChannels = SIGNATURE_CHANNELS;
+	assert(channels >= 1 && channels <= 4);
+
+	Key* out = &m_blocks[size_t(y) * m_width];
+	for (int b = 0; b < m_width; ++b)
+	{
+		uint32_t lane[kChannels];
+		for (int k = 0; k < kChannels; ++k)
+		{
+			lane[k] = BlockSum(sums[b * channels + min(k, channels - 1)]);
+		}
+		out[b] = FingerprintSignature::pack(lane);
+	}
+	m_rows[y] = hashKeys(out, m_width);
+}
+
+// channels known at compile time, the inner loops unroll
+template<int Channels>
+static void sumBlocksOf(const uint8_t* pixels, int pixel_width, int block_width, uint32_t* sums)
+{
+	const int blocks = (pixel_width + block_width - 1) / block_width;
+	for (int b = 0; b < blocks; ++b)
+	{
+		const uint8_t* p = pixels + b * block_width * Channels;
+		const uint8_t* end = pixels + min((b + 1) * block_width, pixel_width) * Channels;
+		uint32_t sum[Channels] = {};
+		for (; p < end; p += Channels)
+		{
+			for (int c = 0; c < Channels; ++c)
+			{
+				sum[c] += p[c];
+			}
+		}
+		for (int c = 0; c < Channels; ++c)
+		{
+			sums[b * Channels + c] = sum[c];
+		}
+	}
+}
+
+void RowFingerprint::sumBlocks(const uint8_t* pixels, int pixel_width, int channels, int block_width, 
+	uint32_t* sums)
+{
+	assert(block_width <= SIGNATURE_BLOCK_WIDTH);
+	switch (channels)
+	{
+	case 1: sumBlocksOf<1>(pixels, pixel_width, block_width, sums); break;
+	case 2: sumBlocksOf<2>(pixels, pixel_width, block_width, sums); break;
+	case 3: sumBlocksOf<3>(pixels, pixel_width, block_width, sums); break;
+	default: sumBlocksOf<4>(pixels, pixel_width, block_width, sums); break;
+	}
+}
+
+void RowFingerprint::pairBlocks(const uint32_t* sums, int blocks, int channels, uint32_t* res)
+{
+	const int pairs = blocks / 2;
+	for (int i = 0; i < pairs * channels; i += channels)
+	{
+		for (int c = 0; c < channels; ++c)
+		{
+			res[i + c] = sums[2 * i + c] + sums[2 * i + channels + c];
+		}
+	}
+
+	// an odd last block is the partial wide one
+	if (blocks & 1)
+	{
+		for (int c = 0; c < channels; ++c)
+		{
+			res[pairs * channels + c] = sums[(blocks - 1) * channels + c];
+		}
+	}
+}
+
+RowFingerprint RowFingerprint::crop(int head, int tail) const
+{
+	RowFingerprint res;
+	crop(head, tail, res);
+	return res;
+}
+
+void RowFingerprint::crop(int head, int tail, RowFingerprint& res) const
+{
+	res.m_width = m_width;
+	res.m_height = m_height - head - tail;
+	res.m_blocks.assign(m_blocks.begin() + size_t(head) * m_width, 
+		m_blocks.begin() + size_t(m_height - tail) * m_width);
+	res.m_rows.assign(m_rows.begin() + head, m_rows.begin() + (m_height - tail));
+}
+
+RowFingerprint RowFingerprint::selectColumns(const std::vector<uint8_t>& skip) const
+{
+	vector<int> keep;
+	for (int b = 0; b < m_width; ++b)
+	{
+		if (!skip[b])
+			keep.push_back(b);
+	}
+
+	RowFingerprint res;
+	res.m_width = (int)keep.size();
+	res.m_height = m_height;
+	res.m_blocks.resize(size_t(res.m_width) * m_height);
+	res.m_rows.resize(m_height);
+	for (int y = 0; y < m_height; ++y)
+	{
+		const Key* in = blocks(y);
+		Key* out = &res.m_blocks[size_t(y) * res.m_width];
+		for (int i = 0; i < res.m_width; ++i)
+		{
+			out[i] = in[keep[i]];
+		}
+		res.m_rows[y] = hashKeys(out, res.m_width);
+	}
+	return res;
+}
+
+uint64_t RowFingerprint::frameHash(int head, int tail) const
+{
+	const uint64_t prime = 1099511628211ULL;
+	uint64_t h = (14695981039346656037ULL ^ uint64_t(m_width)) * prime;
+	h = (h ^ uint64_t(m_height - head - tail)) * prime;
+	for (int y = head; y < m_height - tail; ++y)
+	{
+		h = (h ^ m_rows[y]) * prime;
+	}
+	return h;
+}
+
+uint64_t RowFingerprint::hashKeys(const Key* keys, int n)
+{
+	const uint64_t prime = 1099511628211ULL;
+
+	// four independent lanes, no loop carried dependency between them
+	uint64_t lane[4] = { 14695981039346656037ULL, 0x9e3779b97f4a7c15ULL, 
+		0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL };
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		for (int l = 0; l < 4; ++l)
+		{
+			lane[l] = (lane[l] ^ keys[i + l]) * prime;
+		}
+	}
+	for (; i < n; ++i)
+	{
+		lane[0] = (lane[0] ^ keys[i]) * prime;
+	}
+
+	uint64_t h = lane[0];
+	for (int l = 1; l < 4; ++l)
+	{
+		h = (h ^ (lane[l] >> 29) ^ lane[l]) * prime;
+	}
+	return h;
+}
+
+// countEqual kernels, picked once from what the CPU supports
+typedef RowFingerprint::Key Key;
+typedef int (*CountEqualFn)(const Key* a, const Key* b, int n);
+
+static int countEqualScalar(const Key* a, const Key* b, int n)
+{
+	int match = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		match += (a[i] == b[i]);
+	}
+	return match;
+}
+
+#if defined(_M_IX86) || defined(_M_X64)
+
+// equal lanes compare to all ones (-1), subtracting them counts per lane.
+// a lane counts a few keys of one row only, even 16 bit lanes cannot wrap
+
+template<typename T> struct KeyLanes;
+
+template<> struct KeyLanes<uint16_t>
+{
+	static __m128i eq(__m128i a, __m128i b) { return _mm_cmpeq_epi16(a, b); }
+	static __m128i sub(__m128i a, __m128i b) { return _mm_sub_epi16(a, b); }
+	static __m256i eq(__m256i a, __m256i b) { return _mm256_cmpeq_epi16(a, b); }
+	static __m256i sub(__m256i a, __m256i b) { return _mm256_sub_epi16(a, b); }
+};
+
+template<> struct KeyLanes<uint32_t>
+{
+	static __m128i eq(__m128i a, __m128i b) { return _mm_cmpeq_epi32(a, b); }
+	static __m128i sub(__m128i a, __m128i b) { return _mm_sub_epi32(a, b); }
+	static __m256i eq(__m256i a, __m256i b) { return _mm256_cmpeq_epi32(a, b); }
+	static __m256i sub(__m256i a, __m256i b) { return _mm256_sub_epi32(a, b); }
+};
+
+template<> struct KeyLanes<uint64_t>
+{
+	static __m128i eq(__m128i a, __m128i b) { return _mm_cmpeq_epi64(a, b); }
+	static __m128i sub(__m128i a, __m128i b) { return _mm_sub_epi64(a, b); }
+	static __m256i eq(__m256i a, __m256i b) { return _mm256_cmpeq_epi64(a, b); }
+	static __m256i sub(__m256i a, __m256i b) { return _mm256_sub_epi64(a, b); }
+};
+
+typedef KeyLanes<Key> Lanes;
+
+static int sumLanes(const Key* lanes, int n)
+{
+	int res = 0;
+	for (int l = 0; l < n; ++l)
+	{
+		res += int(lanes[l]);
+	}
+	return res;
+}
+
+static int countEqualSse41(const Key* a, const Key* b, int n)
+{
+	const int kLanes = 16 / sizeof(Key);
+	__m128i acc = _mm_setzero_si128();
+	int i = 0;
+	for (; i + kLanes <= n; i += kLanes)
+	{
+		__m128i eq = Lanes::eq(_mm_loadu_si128((const __m128i*)(a + i)), 
+			_mm_loadu_si128((const __m128i*)(b + i)));
+		acc = Lanes::sub(acc, eq);
+	}
+
+	Key lanes[kLanes];
+	_mm_storeu_si128((__m128i*)lanes, acc);
+	return sumLanes(lanes, kLanes) + countEqualScalar(a + i, b + i, n - i);
+}
+
+static int countEqualAvx2(const Key* a, const Key* b, int n)
+{
+	const int kLanes = 32 / sizeof(Key);
+	__m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+	int i = 0;
+	for (; i + 2 * kLanes <= n; i += 2 * kLanes)
+	{
+		__m256i eq0 = Lanes::eq(_mm256_loadu_si256((const __m256i*)(a + i)),
+			_mm256_loadu_si256((const __m256i*)(b + i)));
+		__m256i eq1 = Lanes::eq(_mm256_loadu_si256((const __m256i*)(a + i + kLanes)),
+			_mm256_loadu_si256((const __m256i*)(b + i + kLanes)));
+		acc0 = Lanes::sub(acc0, eq0);
+		acc1 = Lanes::sub(acc1, eq1);
+	}
+	for (; i + kLanes <= n; i += kLanes)
+	{
+		__m256i eq = Lanes::eq(_mm256_loadu_si256((const __m256i*)(a + i)),
+			_mm256_loadu_si256((const __m256i*)(b + i)));
+		acc0 = Lanes::sub(acc0, eq);
+	}
+
+	Key lanes0[kLanes], lanes1[kLanes];
+	_mm256_storeu_si256((__m256i*)lanes0, acc0);
+	_mm256_storeu_si256((__m256i*)lanes1, acc1);
+	_mm256_zeroupper();
+	return sumLanes(lanes0, kLanes) + sumLanes(lanes1, kLanes) + countEqualScalar(a + i, b + i, n - i);
+}
+
+static CountEqualFn selectCountEqual()
+{
+	int info[4];
+	__cpuid(info, 0);
+	const int max_leaf = info[0];
+
+	__cpuid(info, 1);
+	const bool sse41 = (info[2] & (1 << 19)) != 0;
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+
+	// AVX2 also needs the OS to save the ymm registers
+	bool avx2 = false;
+	if (max_leaf >= 7 && osxsave && (_xgetbv(0) & 6) == 6)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+
+	if (avx2)
+		return countEqualAvx2;
+	if (sse41)
+		return countEqualSse41;
+	return countEqualScalar;
+}
+
+#else
+
+static CountEqualFn selectCountEqual()
+{
+	return countEqualScalar;
+}
+
+#endif
+
+static const CountEqualFn s_count_equal = selectCountEqual();
+
+int RowFingerprint::countEqual(const Key* a, const Key* b, int n)
+{
+	return s_count_equal(a, b, n);
+}
+
+bool RowFingerprint::rowEqual(const RowFingerprint& a, int y0, const RowFingerprint& b, int y1)
+{
+	return a.m_width == b.m_width && a.m_rows[y0] == b.m_rows[y1] &&
+		memcmp(a.blocks(y0), b.blocks(y1), sizeof(Key) * a.m_width) == 0;
+}
+
+bool RowFingerprint::frameEqual(const RowFingerprint& a, const RowFingerprint& b)
+{
+	if (a.m_width != b.m_width || a.m_height != b.m_height)
+		return false;
+	for (int y = 0; y < a.m_height; ++y)
+	{
+		if (!rowEqual(a, y, b, y))
+			return false;
+	}
+	return true;
+}
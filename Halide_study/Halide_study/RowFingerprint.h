@@ -0,0 +1,88 @@
+/************************************************************************/
+/* RowFingerprint:
+	compact per-row and per-block keys of a block sum image, built once
+	at load time and shared by head/tail detection and overlap search
+*/
+/************************************************************************/
+
+#pragma once
+#include <vector>
+#include <stdint.h>
+#include "Halide.h"
+#include "BlockSignature.h"
+
+class RowFingerprint
+{
+public:
+	// narrowest integer holding SIGNATURE_CHANNELS block sums, see BlockSignature.h
+	typedef FingerprintSignature::Key Key;
+
+	RowFingerprint() : m_width(0), m_height(0) {}
+
+	// sums is the (block, height, channel) output of a block sum pass
+	explicit RowFingerprint(const Halide::Image<BlockSum>& sums)
+	{
+		build(sums);
+	}
+
+	void build(const Halide::Image<BlockSum>& sums);
+
+	// row by row: resize to width blocks and height rows, then set each row
+	// from its block sums. same keys as build(). the storage only grows
+	void resize(int width, int height);
+
+	// no rows, the storage is kept for the next resize
+	void clear();
+
+	// sums[b * channels + c]: sum of channel c over block b
+	void setRow(int y, const uint32_t* sums, int channels);
+
+	// block sums of a row of interleaved 8 bit pixels, laid out as setRow takes
+	// them. the last block may be partial, as the prefix sums see it
+	static void sumBlocks(const uint8_t* pixels, int pixel_width, int channels, int block_width, 
+		uint32_t* sums);
+
+	// sums of blocks twice as wide from pairs of blocks, (blocks + 1) / 2 of them
+	static void pairBlocks(const uint32_t* sums, int blocks, int channels, uint32_t* res);
+
+	// rows [head, height - tail) only, keys are copied
+	RowFingerprint crop(int head, int tail) const;
+
+	// same into res, reusing its storage
+	void crop(int head, int tail, RowFingerprint& res) const;
+
+	// blocks b with skip[b] == 0 only, rows hashed again
+	RowFingerprint selectColumns(const std::vector<uint8_t>& skip) const;
+
+	int width() const { return m_width; }
+
+	int height() const { return m_height; }
+
+	uint64_t row(int y) const { return m_rows[y]; }
+
+	const Key* blocks(int y) const { return &m_blocks[size_t(y) * m_width]; }
+
+	// one hash of rows [head, height - tail), what consecutive frames are
+	// compared by to drop duplicates
+	uint64_t frameHash(int head = 0, int tail = 0) const;
+
+	static uint64_t hashKeys(const Key* keys, int n);
+
+	// number of equal keys in a[0..n) and b[0..n), SSE4.1 / AVX2 picked at startup
+	static int countEqual(const Key* a, const Key* b, int n);
+
+	// row y0 of a and row y1 of b have the same width and all keys equal
+	static bool rowEqual(const RowFingerprint& a, int y0, const RowFingerprint& b, int y1);
+
+	// a and b have the same shape and all keys equal, what an equal frameHash only suggests
+	static bool frameEqual(const RowFingerprint& a, const RowFingerprint& b);
+
+	// m_blocks[y * m_width + b], row major so a row is one contiguous run
+	std::vector<Key> m_blocks;
+
+	// one hash of every row of m_blocks
+	std::vector<uint64_t> m_rows;
+
+private:
+	int m_width, m_height;
+};
@@ -0,0 +1,81 @@
+/************************************************************************/
+/* RowPrefixSum:
+	horizontal prefix sum of every row, built once per image. block sums
+	of any width over any row range are answered by subtraction
+*/
+/************************************************************************/
+
+#include "stdafx.h"
+#include "RowPrefixSum.h"
+#include "HalidePipelines.h"
+#ifdef HALIDE_AOT
+#include "row_prefix_sum.h"
+#include "prefix_block_sums.h"
+#else
+#include "PipelineCache.h"
+#endif // HALIDE_AOT
+
+using namespace std;
+using namespace Halide;
+
+RowPrefixSum::~RowPrefixSum()
+{
+	if (m_buffers)
+		m_buffers->release(m_prefix);
+}
+
+void RowPrefixSum::build(const Halide::Image<uint8_t>& input)
+{
+	if (m_buffers)
+		m_buffers->release(m_prefix);
+	m_prefix = allocate<BlockSum>(input.width() + 1, input.height(), input.channels());
+
+#ifdef HALIDE_AOT
+	HalidePipelines::check(row_prefix_sum(input.raw_buffer(), m_prefix.raw_buffer()), "row_prefix_sum");
+#else
+	PipelineCache::Pipeline& p = PipelineCache::instance().get("row_prefix_sum", UInt(8), input.channels(),
+		[](PipelineCache::Pipeline& p) { return HalidePipelines::rowPrefixSum(p.input); });
+	lock_guard<mutex> lock(p.mutex);
+	p.input.set(input);
+	p.func.realize(m_prefix);
+#endif // HALIDE_AOT
+}
+
+Halide::Image<BlockSum> RowPrefixSum::blockSums(int block_width, int head, int tail) const
+{
+	assert(block_width <= SIGNATURE_BLOCK_WIDTH);
+	const int w = width();
+	int block = w / block_width;
+	if (w > block * block_width)
+		++block;
+
+	Halide::Image<BlockSum> output = allocate<BlockSum>(block, height() - head - tail, channels());
+
+#ifdef HALIDE_AOT
+	HalidePipelines::check(prefix_block_sums(m_prefix.raw_buffer(), block_width, head, output.raw_buffer()), "prefix_block_sums");
+#else
+	PipelineCache::Pipeline& p = PipelineCache::instance().get("prefix_block_sums", type_of<BlockSum>(), channels(),
+		[](PipelineCache::Pipeline& p) { return HalidePipelines::prefixBlockSums(p.input, p.arg[0], p.arg[1]); });
+	lock_guard<mutex> lock(p.mutex);
+	p.input.set(m_prefix);
+	p.arg[0].set(block_width);
+	p.arg[1].set(head);
+	p.func.realize(output);
+#endif // HALIDE_AOT
+
+#ifdef DO_ASSERT
+	for (int j = 0; j < output.height(); ++j)
+	{
+		for (int bi = 0; bi < block; ++bi)
+		{
+			const int end = std::min((bi + 1) * block_width, w);
+			for (int k = 0; k < channels(); ++k)
+			{
+				assert(output(bi, j, k) == BlockSum(m_prefix(end, j + head, k) - m_prefix(bi * block_width, j + head, k)));
+			}
+		}
+	}
+#endif // DO_ASSERT
+
+	return output;
+}
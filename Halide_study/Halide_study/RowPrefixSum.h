@@ -0,0 +1,54 @@
+/************************************************************************/
+/* RowPrefixSum:
+	horizontal prefix sum of every row, built once per image. block sums
+	of any width over any row range are answered by subtraction
+*/
+/************************************************************************/
+
+#pragma once
+#include "Halide.h"
+#include "BlockSignature.h"
+#include "BufferPool.h"
+
+class RowPrefixSum
+{
+public:
+	// buffers: m_prefix and the block sums come from it, m_prefix goes back
+	// to it on destruction. NULL allocates
+	explicit RowPrefixSum(BufferPool* buffers = NULL) : m_buffers(buffers) {}
+
+	explicit RowPrefixSum(const Halide::Image<uint8_t>& input, BufferPool* buffers = NULL)
+		: m_buffers(buffers)
+	{
+		build(input);
+	}
+
+	~RowPrefixSum();
+
+	RowPrefixSum(const RowPrefixSum&) = delete;
+	RowPrefixSum& operator=(const RowPrefixSum&) = delete;
+
+	void build(const Halide::Image<uint8_t>& input);
+
+	// (block, row, channel) sums of rows [head, height - tail), a partial last
+	// block sums the pixels it has. the caller may release the result to the same BufferPool
+	Halide::Image<BlockSum> blockSums(int block_width, int head = 0, int tail = 0) const;
+
+	int width() const { return m_prefix.width() - 1; }
+
+	int height() const { return m_prefix.height(); }
+
+	int channels() const { return m_prefix.channels(); }
+
+	// m_prefix(x, y, c) = sum of input(0 .. x-1, y, c), wrapping at the BlockSum range
+	Halide::Image<BlockSum> m_prefix;
+
+private:
+	template<typename T>
+	Halide::Image<T> allocate(int width, int height, int channels) const
+	{
+		return m_buffers ? m_buffers->acquire<T>(width, height, channels) : Halide::Image<T>(width, height, channels);
+	}
+
+	BufferPool* m_buffers;
+};
@@ -0,0 +1,55 @@
+/************************************************************************/
+/* RowSink:
+	receiver of finalized output rows, written top to bottom
+*/
+/************************************************************************/
+
+#include "stdafx.h"
+#include "RowSink.h"
+
+using namespace std;
+
+void ImageRowSink::writeRows(const ImageView<uint8_t>& src)
+{
+	if (m_planes.empty())
+	{
+		m_width = src.width();
+		m_channels = src.channels();
+		m_planes.resize(m_channels);
+	}
+	assert(src.width() == m_width && src.channels() == m_channels && src.stride(0) == 1);
+
+	for (int c = 0; c < m_channels; ++c)
+	{
+		vector<uint8_t>& plane = m_planes[c];
+		for (int y = 0; y < src.height(); ++y)
+		{
+			const uint8_t* row = &src(0, y, c);
+			plane.insert(plane.end(), row, row + m_width);
+		}
+	}
+	m_height += src.height();
+}
+
+void ImageRowSink::finish()
+{
+	if (m_height == 0)
+		return;
+
+	m_result = Halide::Image<uint8_t>(m_width, m_height, m_channels);
+	for (int c = 0; c < m_channels; ++c)
+	{
+		for (int y = 0; y < m_height; ++y)
+		{
+			memcpy(&m_result(0, y, c), &m_planes[c][size_t(y) * m_width], m_width);
+		}
+		vector<uint8_t>().swap(m_planes[c]);
+	}
+}
+
+void ImageRowSink::reset()
+{
+	m_planes.clear();
+	m_width = m_height = m_channels = 0;
+	m_result = Halide::Image<uint8_t>();
+}
@@ -0,0 +1,44 @@
+/************************************************************************/
+/* RowSink:
+	receiver of finalized output rows, written top to bottom
+*/
+/************************************************************************/
+
+#pragma once
+#include <vector>
+#include <stdint.h>
+#include "Halide.h"
+#include "ImageView.h"
+
+class RowSink
+{
+public:
+	virtual ~RowSink() {}
+
+	// all rows of src go right below the rows written so far. src is valid
+	// during the call only, the caller may reuse its pixels once it returns:
+	// a sink that keeps rows copies them
+	virtual void writeRows(const ImageView<uint8_t>& src) = 0;
+
+	// no more rows will come
+	virtual void finish() {}
+};
+
+// collects all rows and builds one image at finish
+class ImageRowSink : public RowSink
+{
+public:
+	ImageRowSink() : m_width(0), m_height(0), m_channels(0) {}
+
+	virtual void writeRows(const ImageView<uint8_t>& src);
+
+	virtual void finish();
+
+	void reset();
+
+	Halide::Image<uint8_t> m_result;
+
+private:
+	int m_width, m_height, m_channels;
+	std::vector<std::vector<uint8_t> > m_planes;
+};
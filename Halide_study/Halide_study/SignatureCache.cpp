@@ -0,0 +1,209 @@
+/************************************************************************/
+/* SignatureCache:
+	on disk cache of the row keys of input frames, one small binary file
+	per frame named by the hash of its contents. a re-run, or a run over
+	a capture with frames appended, reads the keys of the frames it has
+	seen before instead of summing their pixels again
+*/
+/************************************************************************/
+
+#include "stdafx.h"
+#include "SignatureCache.h"
+#include <direct.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <thread>
+#include <sstream>
+
+using namespace std;
+
+// bump when the file layout or the key packing changes
+static const uint32_t kVersion = 2;
+
+SignatureCache::SignatureCache(const std::string& dir)
+	: m_dir(dir), m_hits(0), m_misses(0)
+{
+	_mkdir(m_dir.c_str());
+}
+
+// xxHash64 primes
+static const uint64_t kPrime1 = 11400714785074694791ULL, kPrime2 = 14029467366897019727ULL,
+	kPrime4 = 9650029242287828579ULL, kPrime5 = 2870177450012600261ULL;
+
+static inline uint64_t rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+// xxHash64 round: the multiply carries every word bit upwards, the rotation
+// brings the high bits back down before the next word, so no two words cancel
+static inline uint64_t hashRound(uint64_t lane, uint64_t word)
+{
+	return rotl(lane + word * kPrime2, 31) * kPrime1;
+}
+
+static inline uint64_t hashMerge(uint64_t h, uint64_t value)
+{
+	return (h ^ hashRound(0, value)) * kPrime1 + kPrime4;
+}
+
+// murmur3 finalizer, every input bit flips about half the output bits
+static inline uint64_t fmix64(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+uint64_t SignatureCache::hashFile(const std::string& filename)
+{
+	struct _stat64 st;
+	if (_stat64(filename.c_str(), &st) != 0)
+		return 0;
+
+	FILE* file = fopen(filename.c_str(), "rb");
+	if (!file)
+		return 0;
+
+	// four independent lanes, 32 bytes a step
+	uint64_t lane[4] = { kPrime1 + kPrime2, kPrime2, 0, 0 - kPrime1 };
+	vector<uint64_t> buf(1 << 13);
+	uint64_t size = 0;
+	size_t n;
+	while ((n = fread(buf.data(), 1, buf.size() * sizeof(uint64_t), file)) > 0)
+	{
+		// zero the tail of a short read, the size below tells the lengths apart
+		const size_t words = (n + 7) / 8;
+		memset((char*)buf.data() + n, 0, words * 8 - n);
+		size_t i = 0;
+		for (; i + 4 <= words; i += 4)
+		{
+			for (int l = 0; l < 4; ++l)
+			{
+				lane[l] = hashRound(lane[l], buf[i + l]);
+			}
+		}
+		for (; i < words; ++i)
+		{
+			lane[0] = hashRound(lane[0], buf[i]);
+		}
+		size += n;
+	}
+	const bool failed = ferror(file) != 0;
+	fclose(file);
+	if (failed)
+		return 0;
+
+	// size and time too: a rewritten file does not meet the keys of its old
+	// version even where the contents hash collides
+	uint64_t h = size * kPrime5;
+	for (int l = 0; l < 4; ++l)
+	{
+		h = hashMerge(h, lane[l]);
+	}
+	h = hashMerge(h, size);
+	h = fmix64(hashMerge(h, uint64_t(st.st_mtime)));
+	return h ? h : 1;
+}
+
+std::string SignatureCache::path(uint64_t hash) const
+{
+	char name[32];
+	sprintf_s(name, "%016llx.sig", (unsigned long long)hash);
+	return m_dir + "/" + name;
+}
+
+bool SignatureCache::load(uint64_t hash, const std::vector<int>& block_widths, 
+	std::vector<RowFingerprint>& keys)
+{
+	FILE* file = fopen(path(hash).c_str(), "rb");
+	if (!file)
+	{
+		++m_misses;
+		return false;
+	}
+
+	Header header;
+	bool ok = fread(&header, sizeof(header), 1, file) == 1 && 
+		memcmp(header.magic, "RSIG", 4) == 0 && header.version == kVersion &&
+		header.key_bytes == sizeof(RowFingerprint::Key) && header.key_channels == SIGNATURE_CHANNELS &&
+		header.key_block_width == SIGNATURE_BLOCK_WIDTH && header.key_lane_bits == FingerprintSignature::kLaneBits &&
+		header.count == block_widths.size();
+
+	// the sizes in the header must add up to the file, a corrupt one would
+	// otherwise resize the keys to anything
+	if (ok)
+	{
+		uint64_t expected = sizeof(header);
+		for (size_t i = 0; i < block_widths.size(); ++i)
+		{
+			const uint64_t blocks = (uint64_t(header.pixel_width) + block_widths[i] - 1) / block_widths[i];
+			expected += sizeof(uint32_t) + (blocks * sizeof(RowFingerprint::Key) + sizeof(uint64_t)) * header.height;
+		}
+		ok = fseek(file, 0, SEEK_END) == 0 && uint64_t(ftell(file)) == expected && 
+			fseek(file, sizeof(header), SEEK_SET) == 0;
+	}
+
+	keys.resize(block_widths.size());
+	for (size_t i = 0; ok && i < keys.size(); ++i)
+	{
+		uint32_t block_width = 0;
+		ok = fread(&block_width, sizeof(block_width), 1, file) == 1 && (int)block_width == block_widths[i];
+		if (!ok)
+			break;
+
+		RowFingerprint& k = keys[i];
+		k.resize((header.pixel_width + block_width - 1) / block_width, header.height);
+		ok = fread(k.m_blocks.data(), sizeof(RowFingerprint::Key), k.m_blocks.size(), file) == k.m_blocks.size() &&
+			fread(k.m_rows.data(), sizeof(uint64_t), k.m_rows.size(), file) == k.m_rows.size();
+	}
+	fclose(file);
+
+	if (!ok)
+	{
+		keys.clear();
+		++m_misses;
+		return false;
+	}
+	++m_hits;
+	return true;
+}
+
+bool SignatureCache::store(uint64_t hash, int pixel_width, const std::vector<int>& block_widths, 
+	const std::vector<RowFingerprint>& keys)
+{
+	if (keys.size() != block_widths.size() || keys.empty())
+		return false;
+
+	// unique per writer, two jobs may store the same frame at once
+	ostringstream tmp;
+	tmp << path(hash) << "." << this_thread::get_id() << ".tmp";
+	FILE* file = fopen(tmp.str().c_str(), "wb");
+	if (!file)
+		return false;
+
+	Header header = { { 'R', 'S', 'I', 'G' }, kVersion, sizeof(RowFingerprint::Key), SIGNATURE_CHANNELS,
+		SIGNATURE_BLOCK_WIDTH, FingerprintSignature::kLaneBits, (uint32_t)pixel_width, (uint32_t)keys[0].height(), (uint32_t)keys.size() };
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	for (size_t i = 0; ok && i < keys.size(); ++i)
+	{
+		const uint32_t block_width = block_widths[i];
+		const RowFingerprint& k = keys[i];
+		ok = fwrite(&block_width, sizeof(block_width), 1, file) == 1 &&
+			fwrite(k.m_blocks.data(), sizeof(RowFingerprint::Key), k.m_blocks.size(), file) == k.m_blocks.size() &&
+			fwrite(k.m_rows.data(), sizeof(uint64_t), k.m_rows.size(), file) == k.m_rows.size();
+	}
+	ok = fclose(file) == 0 && ok;
+
+	// an existing file holds the same keys, keep it
+	if (!ok || rename(tmp.str().c_str(), path(hash).c_str()) != 0)
+	{
+		remove(tmp.str().c_str());
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,53 @@
+/************************************************************************/
+/* SignatureCache:
+	on disk cache of the row keys of input frames, one small binary file
+	per frame named by a hash of its contents, size and modification time.
+	a re-run, or a run over a capture with frames appended, reads the keys
+	of the frames it has seen before instead of summing their pixels again
+*/
+/************************************************************************/
+
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "RowFingerprint.h"
+
+class SignatureCache
+{
+public:
+	// dir is created when missing
+	explicit SignatureCache(const std::string& dir);
+
+	// hash of the file contents, size and modification time, 0 when it cannot be read
+	static uint64_t hashFile(const std::string& filename);
+
+	// keys of block_widths stored under hash, false when there are none or
+	// they were written by a build with other key types
+	bool load(uint64_t hash, const std::vector<int>& block_widths, std::vector<RowFingerprint>& keys);
+
+	// keys[i] of block_widths[i], written to a temporary file and renamed so
+	// readers in other processes never see a partial file
+	bool store(uint64_t hash, int pixel_width, const std::vector<int>& block_widths, 
+		const std::vector<RowFingerprint>& keys);
+
+	std::string path(uint64_t hash) const;
+
+	// loads that found keys, loads that did not
+	int hits() const { return m_hits; }
+
+	int misses() const { return m_misses; }
+
+private:
+	struct Header
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t key_bytes, key_channels, key_block_width, key_lane_bits;
+		uint32_t pixel_width, height, count;
+	};
+
+	std::string m_dir;
+	std::atomic<int> m_hits, m_misses;
+};
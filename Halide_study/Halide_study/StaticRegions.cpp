@@ -0,0 +1,104 @@
+/************************************************************************/
+/* StaticRegions:
+	parts of the screen that stay put while the page scrolls, found over
+	the block keys of all frames at once: the common sticky header and
+	footer, and block columns that hold still between them (sidebars,
+	floating buttons, empty margins) which the matcher can leave out
+*/
+/************************************************************************/
+
+#include "stdafx.h"
+#include "StaticRegions.h"
+#include <algorithm>
+
+using namespace std;
+
+// row y is shared when every frame has at least min_equal of its keys equal to frame 0
+static bool rowShared(const std::vector<RowFingerprint>& frames, int y, int width, float min_equal)
+{
+	for (size_t i = 1; i < frames.size(); ++i)
+	{
+		int match = RowFingerprint::countEqual(frames[0].blocks(y), frames[i].blocks(y), width);
+		if ((float)match / width < min_equal)
+			return false;
+	}
+	return true;
+}
+
+std::tuple<int, int> StaticRegions::findHeadAndTail(const std::vector<RowFingerprint>& frames)
+{
+	int height = frames[0].height(), width = frames[0].width();
+	for (size_t i = 1; i < frames.size(); ++i)
+	{
+		height = min(height, frames[i].height());
+		width = min(width, frames[i].width());
+	}
+
+	int head = 0, tail = height - 1;
+	for (; head < height; ++head)
+	{
+		if (!rowShared(frames, head, width, 0.5f))
+		{
+			--head;
+			break;
+		}
+	}
+
+	for (; tail >= 0; --tail)
+	{
+		if (!rowShared(frames, tail, width, 0.9f))
+		{
+			++tail;
+			break;
+		}
+	}
+
+	tail = frames[0].height() - 1 - tail;
+
+	return tuple<int, int>(head, tail);
+}
+
+std::vector<uint8_t> StaticRegions::staticColumns(const std::vector<RowFingerprint>& frames, 
+	int head, int tail, float min_equal, float min_keep)
+{
+	const int width = frames[0].width();
+	vector<uint8_t> mask(width, 0);
+	const int rows = frames[0].height() - head - tail;
+	if (frames.size() < 2 || rows <= 0)
+		return mask;
+
+	// equal[b]: rows where column b holds the same key in all frames
+	vector<int> equal(width, 0);
+	vector<uint8_t> same(width);
+	for (int y = head; y < head + rows; ++y)
+	{
+		fill(same.begin(), same.end(), 1);
+		const RowFingerprint::Key* ref = frames[0].blocks(y);
+		for (size_t i = 1; i < frames.size(); ++i)
+		{
+			const RowFingerprint::Key* keys = frames[i].blocks(y);
+			for (int b = 0; b < width; ++b)
+			{
+				same[b] &= (ref[b] == keys[b]);
+			}
+		}
+		for (int b = 0; b < width; ++b)
+		{
+			equal[b] += same[b];
+		}
+	}
+
+	int kept = width;
+	for (int b = 0; b < width; ++b)
+	{
+		if (equal[b] >= min_equal * rows)
+		{
+			mask[b] = 1;
+			--kept;
+		}
+	}
+
+	if (kept < min_keep * width)
+		fill(mask.begin(), mask.end(), 0);
+	return mask;
+}
@@ -0,0 +1,28 @@
+/************************************************************************/
+/* StaticRegions:
+	parts of the screen that stay put while the page scrolls, found over
+	the block keys of all frames at once: the common sticky header and
+	footer, and block columns that hold still between them (sidebars,
+	floating buttons, empty margins) which the matcher can leave out
+*/
+/************************************************************************/
+
+#pragma once
+#include <vector>
+#include <tuple>
+#include <stdint.h>
+#include "RowFingerprint.h"
+
+class StaticRegions
+{
+public:
+	// header and footer shared by every frame with frame 0, same thresholds and
+	// result convention as findHeadAndTail2 (index of the last shared row)
+	static std::tuple<int, int> findHeadAndTail(const std::vector<RowFingerprint>& frames);
+
+	// per block column, nonzero when at least min_equal of the rows between head
+	// and tail hold the same key in every frame. all zero when fewer than
+	// min_keep columns would be left to match on
+	static std::vector<uint8_t> staticColumns(const std::vector<RowFingerprint>& frames, 
+		int head, int tail, float min_equal = 0.95f, float min_keep = 0.125f);
+};
@@ -0,0 +1,133 @@
+/************************************************************************/
+/* TaskGraph:
+	tasks with dependencies, run by work stealing workers. a task starts
+	as soon as all the tasks it depends on have finished
+*/
+/************************************************************************/
+
+#include "stdafx.h"
+#include "TaskGraph.h"
+
+using namespace std;
+
+TaskGraph::TaskId TaskGraph::add(const std::function<void()>& fn, const std::vector<TaskId>& deps)
+{
+	const TaskId id = (TaskId)m_tasks.size();
+	unique_ptr<Task> task(new Task);
+	task->fn = fn;
+	task->remaining = (int)deps.size();
+	for (size_t i = 0; i < deps.size(); ++i)
+	{
+		assert(deps[i] < id);
+		m_tasks[deps[i]]->dependents.push_back(id);
+	}
+	m_tasks.push_back(move(task));
+	return id;
+}
+
+void TaskGraph::run(int threads)
+{
+	if (threads <= 0)
+		threads = max(1, (int)thread::hardware_concurrency());
+
+	m_queues.clear();
+	for (int i = 0; i < threads; ++i)
+	{
+		m_queues.push_back(unique_ptr<WorkerQueue>(new WorkerQueue));
+	}
+	m_left = (int)m_tasks.size();
+	m_ready = 0;
+
+	// spread the roots over the workers
+	int next = 0;
+	for (size_t i = 0; i < m_tasks.size(); ++i)
+	{
+		if (m_tasks[i]->remaining == 0)
+			push(next++ % threads, (TaskId)i);
+	}
+
+	vector<thread> workers;
+	for (int i = 0; i < threads; ++i)
+	{
+		workers.push_back(thread(&TaskGraph::worker, this, i));
+	}
+	for (int i = 0; i < threads; ++i)
+	{
+		workers[i].join();
+	}
+}
+
+void TaskGraph::worker(int index)
+{
+	for (;;)
+	{
+		{
+			unique_lock<mutex> lock(m_wait_mutex);
+			m_wait_cond.wait(lock, [this] { return m_ready > 0 || m_left == 0; });
+			if (m_left == 0)
+				return;
+		}
+
+		TaskId id;
+		if (!pop(index, id))
+			continue;
+
+		Task& task = *m_tasks[id];
+		task.fn();
+
+		for (size_t i = 0; i < task.dependents.size(); ++i)
+		{
+			const TaskId dep = task.dependents[i];
+			if (--m_tasks[dep]->remaining == 0)
+				push(index, dep);
+		}
+
+		if (--m_left == 0)
+		{
+			lock_guard<mutex> lock(m_wait_mutex);
+			m_wait_cond.notify_all();
+		}
+	}
+}
+
+void TaskGraph::push(int worker, TaskId id)
+{
+	{
+		WorkerQueue& queue = *m_queues[worker];
+		lock_guard<mutex> lock(queue.mutex);
+		queue.tasks.push_back(id);
+	}
+
+	lock_guard<mutex> lock(m_wait_mutex);
+	++m_ready;
+	m_wait_cond.notify_one();
+}
+
+bool TaskGraph::pop(int worker, TaskId& id)
+{
+	const int n = (int)m_queues.size();
+	for (int i = 0; i < n; ++i)
+	{
+		WorkerQueue& queue = *m_queues[(worker + i) % n];
+		lock_guard<mutex> lock(queue.mutex);
+		if (queue.tasks.empty())
+			continue;
+
+		// own work newest first while it is hot, stolen work oldest first
+		if (i == 0)
+		{
+			id = queue.tasks.back();
+			queue.tasks.pop_back();
+		}
+		else
+		{
+			id = queue.tasks.front();
+			queue.tasks.pop_front();
+		}
+
+		lock_guard<mutex> wait_lock(m_wait_mutex);
+		--m_ready;
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,58 @@
+/************************************************************************/
+/* TaskGraph:
+	tasks with dependencies, run by work stealing workers. a task starts
+	as soon as all the tasks it depends on have finished
+*/
+/************************************************************************/
+
+#pragma once
+#include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <thread>
+
+class TaskGraph
+{
+public:
+	typedef int TaskId;
+
+	TaskGraph() : m_left(0), m_ready(0) {}
+
+	// deps must be tasks added before
+	TaskId add(const std::function<void()>& fn, const std::vector<TaskId>& deps = std::vector<TaskId>());
+
+	// run every task and return when all are done, threads <= 0 uses all cores
+	void run(int threads = 0);
+
+private:
+	struct Task
+	{
+		std::function<void()> fn;
+		std::vector<TaskId> dependents;
+		std::atomic<int> remaining;
+	};
+
+	// each worker pushes and pops at the back of its own queue, thieves take the front
+	struct WorkerQueue
+	{
+		std::mutex mutex;
+		std::deque<TaskId> tasks;
+	};
+
+	void worker(int index);
+
+	void push(int worker, TaskId id);
+
+	bool pop(int worker, TaskId& id);
+
+	std::vector<std::unique_ptr<Task> > m_tasks;
+	std::vector<std::unique_ptr<WorkerQueue> > m_queues;
+	std::atomic<int> m_left;
+	int m_ready;
+	std::mutex m_wait_mutex;
+	std::condition_variable m_wait_cond;
+};
@@ -0,0 +1,116 @@
+/************************************************************************/
+/* ThreadPool:
+	fixed set of worker threads running submitted tasks in FIFO order
+*/
+/************************************************************************/
+
+#include "stdafx.h"
+#include "ThreadPool.h"
+#include <atomic>
+
+using namespace std;
+
+ThreadPool::ThreadPool(int threads)
+	: m_running(0), m_stop(false)
+{
+	if (threads <= 0)
+		threads = max(1, (int)thread::hardware_concurrency());
+
+	for (int i = 0; i < threads; ++i)
+	{
+		m_threads.push_back(thread(&ThreadPool::worker, this));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_task_cond.notify_all();
+
+	for (size_t i = 0; i < m_threads.size(); ++i)
+	{
+		m_threads[i].join();
+	}
+}
+
+void ThreadPool::submit(const std::function<void()>& task)
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_tasks.push_back(task);
+	}
+	m_task_cond.notify_one();
+}
+
+void ThreadPool::wait()
+{
+	unique_lock<mutex> lock(m_mutex);
+	m_idle_cond.wait(lock, [this] { return m_tasks.empty() && m_running == 0; });
+}
+
+void ThreadPool::parallelFor(int n, const std::function<void(int)>& fn)
+{
+	struct Shared
+	{
+		atomic<int> next, done;
+		mutex lock;
+		condition_variable cond;
+	};
+	shared_ptr<Shared> shared(new Shared);
+	shared->next = 0;
+	shared->done = 0;
+
+	// helpers starting after everything is taken return at once
+	auto body = [shared, n, fn]
+	{
+		for (int i = shared->next++; i < n; i = shared->next++)
+		{
+			fn(i);
+			if (++shared->done == n)
+			{
+				lock_guard<mutex> lock(shared->lock);
+				shared->cond.notify_all();
+			}
+		}
+	};
+
+	const int helpers = min(size(), n) - 1;
+	for (int i = 0; i < helpers; ++i)
+	{
+		submit(body);
+	}
+	body();
+
+	unique_lock<mutex> lock(shared->lock);
+	shared->cond.wait(lock, [shared, n] { return shared->done == n; });
+}
+
+void ThreadPool::worker()
+{
+	for (;;)
+	{
+		function<void()> task;
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_task_cond.wait(lock, [this] { return m_stop || !m_tasks.empty(); });
+			if (m_tasks.empty())
+				return;
+
+			task = m_tasks.front();
+			m_tasks.pop_front();
+			++m_running;
+		}
+
+		task();
+
+		{
+			lock_guard<mutex> lock(m_mutex);
+			--m_running;
+			if (m_tasks.empty() && m_running == 0)
+				m_idle_cond.notify_all();
+		}
+	}
+}
@@ -0,0 +1,43 @@
+/************************************************************************/
+/* ThreadPool:
+	fixed set of worker threads running submitted tasks in FIFO order
+*/
+/************************************************************************/
+
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+class ThreadPool
+{
+public:
+	// threads <= 0 uses one per hardware thread
+	explicit ThreadPool(int threads = 0);
+
+	~ThreadPool();
+
+	void submit(const std::function<void()>& task);
+
+	// block until every submitted task has finished
+	void wait();
+
+	// run fn(0 .. n-1) on the workers and the calling thread, return when all are done.
+	// safe to call from inside a task
+	void parallelFor(int n, const std::function<void(int)>& fn);
+
+	int size() const { return (int)m_threads.size(); }
+
+private:
+	void worker();
+
+	std::vector<std::thread> m_threads;
+	std::deque<std::function<void()> > m_tasks;
+	std::mutex m_mutex;
+	std::condition_variable m_task_cond, m_idle_cond;
+	int m_running;
+	bool m_stop;
+};
@@ -14,6 +14,7 @@
 #include <ctime>
 #include <vector>
 #include <string>
+#include <memory>
 #include "Halide.h"
 #include "halide_image_io.h"
 